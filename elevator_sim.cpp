@@ -4,357 +4,6733 @@
 #include <limits>
 #include <string>
 #include <fstream>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <cstdint>
+#include <memory>
+#include <cmath>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <new>
+#include <map>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ELEVATOR_HAVE_MMAP 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ELEVATOR_HAVE_AVX2_KERNEL 1
+#define ELEVATOR_HAVE_RDTSC 1
+#endif
+
+#if defined(ELEVATOR_PROFILE) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#define ELEVATOR_HAVE_PERF 1
+#endif
 
 using namespace std;
 
-// ================== Direction ==================
+// Largest configurations accepted from the console and command line.
+const int MAX_FLOORS = 10000;
+const int MAX_ELEVATORS = 1000;
+
+// ================== Allocation counting ==================
+
+#ifdef ELEVATOR_CHECK_ALLOC
+
+// Built with -DELEVATOR_CHECK_ALLOC (make CHECK_ALLOC=1) only: heap
+// allocations made by the current thread, which --check-alloc reads
+// around step() to prove the tick loop is allocation-free once warm.
+// Other builds keep the standard operator new.
+thread_local uint64_t threadAllocations = 0;
+
+// Out of line so GCC's -Wmismatched-new-delete does not see the
+// malloc()/free() pair behind them.
+__attribute__((noinline)) void* operator new(size_t size) {
+    ++threadAllocations;
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+const bool ALLOCATIONS_COUNTED = true;
+inline uint64_t allocationCount() { return threadAllocations; }
+
+#else
+
+const bool ALLOCATIONS_COUNTED = false;
+inline uint64_t allocationCount() { return 0; }
+
+#endif
+
+// ================== Direction ==================
+
+enum class Direction {
+    Idle,
+    Up,
+    Down
+};
+
+const char* directionName(Direction d) {
+    switch (d) {
+        case Direction::Idle: return "Idle";
+        case Direction::Up:   return "Up";
+        case Direction::Down: return "Down";
+    }
+    return "Unknown";
+}
+
+string directionToString(Direction d) {
+    return directionName(d);
+}
+
+// ================== Request ==================
+
+class Request {
+public:
+    int fromFloor;
+    int toFloor;
+    int timeRequested;
+    int passengers;         // people travelling together on this call
+
+    Request(int from, int to, int t, int count = 1)
+        : fromFloor(from), toFloor(to), timeRequested(t), passengers(count) {}
+};
+
+// ================== Copy-on-write storage ==================
+
+/*
+   A vector whose copies share one buffer until one of them writes: edit()
+   first clones the buffer if another copy still holds it. Copying costs a
+   reference count increment, which is what lets ElevatorSystem::fork()
+   hand every car's stops and riders to a child without copying them; each
+   side then pays for a private copy of only what it changes. Copies may
+   be used from different threads, each by one thread at a time.
+*/
+template <typename T>
+class SharedVector {
+private:
+    shared_ptr<vector<T>> items;    // null until first written
+
+    static const vector<T>& none() {
+        static const vector<T> empty;
+        return empty;
+    }
+
+public:
+    SharedVector() {}
+    explicit SharedVector(vector<T>&& values) : items(make_shared<vector<T>>(move(values))) {}
+
+    const vector<T>& get() const { return items ? *items : none(); }
+    size_t size() const { return items ? items->size() : 0; }
+    bool empty() const { return size() == 0; }
+    const T& operator[](size_t k) const { return (*items)[k]; }
+
+    vector<T>& edit() {
+        if (!items) {
+            items = make_shared<vector<T>>();
+        } else if (items.use_count() > 1) {
+            items = make_shared<vector<T>>(*items);
+        }
+        return *items;
+    }
+};
+
+// ================== TargetQueue ==================
+
+// FIFO of floors backed by a power-of-two ring buffer. It grows on demand
+// but never shrinks, so steady-state push/pop does not allocate. The ring
+// is copy-on-write: pop_front only moves head, so a forked queue is
+// copied the first time a floor is written into it. A sorted copy of the
+// queued floors (same capacity, also copy-on-write) answers membership,
+// extreme and range queries in O(log n) without walking the ring.
+class TargetQueue {
+private:
+    SharedVector<int> buf;
+    SharedVector<int> sorted;       // the queued floors in ascending order
+    size_t head;
+    size_t count;
+
+    void grow(size_t capacity) {
+        vector<int> bigger(capacity);
+        for (size_t k = 0; k < count; ++k) {
+            bigger[k] = at(k);
+        }
+        buf = SharedVector<int>(move(bigger));
+        sorted.edit().reserve(capacity);
+        head = 0;
+    }
+
+    void pushRing(int floor) {
+        if (count == buf.size()) {
+            grow(buf.empty() ? 4 : buf.size() * 2);
+        }
+        buf.edit()[(head + count) & (buf.size() - 1)] = floor;
+        ++count;
+    }
+
+    void index(int floor) {
+        vector<int>& floors = sorted.edit();
+        floors.insert(upper_bound(floors.begin(), floors.end(), floor), floor);
+    }
+
+    void unindex(int floor) {
+        vector<int>& floors = sorted.edit();
+        floors.erase(lower_bound(floors.begin(), floors.end(), floor));
+    }
+
+public:
+    TargetQueue() : head(0), count(0) {}
+
+    void clear() {
+        head = 0;
+        count = 0;
+        if (!sorted.empty()) {
+            sorted.edit().clear();
+        }
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    size_t capacity() const { return buf.size(); }
+    int front() const { return buf[head]; }
+    int back() const { return at(count - 1); }
+    int at(size_t k) const { return buf[(head + k) & (buf.size() - 1)]; }
+
+    // Lowest / highest queued floor; the queue must not be empty.
+    int lowest() const { return sorted.get().front(); }
+    int highest() const { return sorted.get().back(); }
+
+    bool contains(int floor) const {
+        return binary_search(sorted.get().begin(), sorted.get().end(), floor);
+    }
+
+    // Lowest queued floor above `floor`, or -1.
+    int above(int floor) const {
+        const vector<int>& floors = sorted.get();
+        auto it = upper_bound(floors.begin(), floors.end(), floor);
+        return it == floors.end() ? -1 : *it;
+    }
+
+    // Queued entries on floors lo..hi, repeats counted once each.
+    int countBetween(int lo, int hi) const {
+        const vector<int>& floors = sorted.get();
+        return static_cast<int>(upper_bound(floors.begin(), floors.end(), hi) -
+                                lower_bound(floors.begin(), floors.end(), lo));
+    }
+
+    // Makes room for n floors, keeping the capacity a power of two.
+    void reserve(size_t n) {
+        size_t capacity = buf.empty() ? 4 : buf.size();
+        while (capacity < n) {
+            capacity *= 2;
+        }
+        if (capacity > buf.size()) {
+            grow(capacity);
+        }
+    }
+
+    void push_back(int floor) {
+        pushRing(floor);
+        index(floor);
+    }
+
+    void pop_front() {
+        unindex(front());
+        head = (head + 1) & (buf.size() - 1);
+        --count;
+    }
+
+    // Drops every occurrence of floor, then every entry that would repeat
+    // the one before it (a second door cycle at the same floor), keeping
+    // the order of the rest. Each dropped entry is appended to `dropped`
+    // as (position before the call, floor) for insertAll(), and `legs` is
+    // set to the floors between consecutive entries that are left.
+    // Returns how many were dropped.
+    size_t removeAll(int floor, vector<pair<size_t, int>>& dropped, int& legs) {
+        if (!contains(floor)) {
+            return 0;
+        }
+        // Every copy of floor leaves the index at once
+        vector<int>& floors = sorted.edit();
+        auto copies = equal_range(floors.begin(), floors.end(), floor);
+        floors.erase(copies.first, copies.second);
+
+        vector<int>& ring = buf.edit();
+        const size_t mask = ring.size() - 1;
+        size_t kept = 0;
+        size_t removed = 0;
+        legs = 0;
+        for (size_t k = 0; k < count; ++k) {
+            int f = at(k);
+            const int last = kept > 0 ? ring[(head + kept - 1) & mask] : f;
+            if (f == floor || (kept > 0 && last == f)) {
+                dropped.emplace_back(k, f);
+                if (f != floor) {
+                    unindex(f);
+                }
+                ++removed;
+            } else {
+                ring[(head + kept) & mask] = f;
+                legs += abs(f - last);
+                ++kept;
+            }
+        }
+        count = kept;
+        return removed;
+    }
+
+    // Undoes removeAll(floor, dropped): puts the dropped entries back where
+    // they were, in one pass from the back of the queue.
+    void insertAll(int floor, const vector<pair<size_t, int>>& dropped) {
+        const size_t kept = count;
+        reserve(kept + dropped.size());
+        count = kept + dropped.size();
+        vector<int>& ring = buf.edit();
+        const size_t mask = ring.size() - 1;
+        size_t from = kept;
+        size_t back = dropped.size();
+        size_t copies = 0;          // of floor, indexed together below
+        for (size_t k = count; k-- > 0; ) {
+            if (back > 0 && dropped[back - 1].first == k) {
+                const int f = dropped[--back].second;
+                ring[(head + k) & mask] = f;
+                if (f == floor) {
+                    ++copies;
+                } else {
+                    index(f);
+                }
+            } else {
+                --from;
+                ring[(head + k) & mask] = ring[(head + from) & mask];
+            }
+        }
+        vector<int>& floors = sorted.edit();
+        floors.insert(lower_bound(floors.begin(), floors.end(), floor), copies, floor);
+    }
+};
+
+// ================== ElevatorFleet ==================
+
+// Order in which a car serves its stops.
+enum class StopOrder {
+    Fifo,           // as added, consecutive repeats merged (TargetQueue)
+    Scan            // collective control: a floor bitset served in LOOK order
+};
+
+/*
+   Structure-of-arrays state for every car in the building. The tick loop
+   and the dispatcher only touch the flat per-field arrays; a car's stops
+   (target ring, or floor bitset under StopOrder::Scan) are consulted only
+   when a stop is added or completed, with the next stop and the stop
+   count mirrored into queueHead / queueSize. What the dispatcher asks of
+   the stops themselves is kept up to date as they change: the FIFO route
+   length and sorted stops (in TargetQueue), and the SCAN extremes plus
+   per-word stop counts. etaTo() costs O(1) (FIFO) or O(log floors)
+   (SCAN), and hasStop() and the extreme stops O(log stops) or O(1),
+   rather than a walk over the stops.
+*/
+struct ElevatorFleet {
+    vector<int> currentFloor;
+    vector<int8_t> direction;        // Direction, stored compactly
+    vector<uint8_t> doorOpen;
+    vector<int> queueHead;           // next target, valid when queueSize > 0
+    vector<int> queueSize;
+    vector<int> totalStopsServed;
+    vector<long long> floorsTraveled;
+    vector<uint8_t> changed;         // floor, stops, direction or door
+                                     // changed; cleared by hall-call
+                                     // reassignment
+    vector<uint8_t> outOfService;    // takes no new calls
+    size_t carsOutOfService = 0;
+    vector<TargetQueue> targets;     // Fifo: floors to visit (queue)
+    vector<int> routeLegs;           // Fifo: floors between consecutive targets
+    vector<uint8_t> crowded;         // Fifo: target ring over half full ...
+    size_t crowdedRings = 0;         // ... until widenRings() grows it
+    vector<pair<size_t, int>> revoked;  // Fifo: entries the last removeTarget() dropped ...
+    int revokedLegs = 0;                // ... and the car's routeLegs before it
+
+    // Scan: car i's stops are the bits of stopBits[i], stopWords words;
+    // both per-car arrays are copy-on-write like the target rings
+    StopOrder order = StopOrder::Fifo;
+    size_t stopWords = 0;
+    vector<SharedVector<uint64_t>> stopBits;
+    vector<SharedVector<int>> stopCounts;   // Fenwick tree of stops per word
+    vector<int> topStop;             // highest / lowest stop, -1 when none
+    vector<int> bottomStop;
+
+    size_t size() const { return currentFloor.size(); }
+
+    void add(int startFloor) {
+        currentFloor.push_back(startFloor);
+        direction.push_back(static_cast<int8_t>(Direction::Idle));
+        doorOpen.push_back(0);
+        queueHead.push_back(startFloor);
+        queueSize.push_back(0);
+        totalStopsServed.push_back(0);
+        floorsTraveled.push_back(0);
+        changed.push_back(0);
+        outOfService.push_back(0);
+        targets.emplace_back();
+        routeLegs.push_back(0);
+        crowded.push_back(0);
+        stopBits.emplace_back(vector<uint64_t>(stopWords, 0));
+        stopCounts.emplace_back(vector<int>(stopWords, 0));
+        topStop.push_back(-1);
+        bottomStop.push_back(-1);
+    }
+
+    // Only while every car is empty: switching drops no stops.
+    void setStopOrder(StopOrder o, int floors) {
+        order = o;
+        stopWords = o == StopOrder::Scan ? (static_cast<size_t>(floors) + 63) / 64 : 0;
+        for (size_t i = 0; i < size(); ++i) {
+            stopBits[i] = SharedVector<uint64_t>(vector<uint64_t>(stopWords, 0));
+            stopCounts[i] = SharedVector<int>(vector<int>(stopWords, 0));
+        }
+    }
+
+    // Switches a FIFO fleet to SCAN at any time: each car keeps the floors
+    // it had queued, as a set served in LOOK order from now on.
+    void convertToScan(int floors) {
+        setStopOrder(StopOrder::Scan, floors);
+        for (size_t i = 0; i < size(); ++i) {
+            TargetQueue queued;
+            swap(queued, targets[i]);
+            queueSize[i] = 0;
+            routeLegs[i] = 0;
+            crowded[i] = 0;
+            topStop[i] = -1;
+            bottomStop[i] = -1;
+            for (size_t k = 0; k < queued.size(); ++k) {
+                addTarget(i, queued.at(k));
+            }
+        }
+        crowdedRings = 0;
+    }
+
+    // Scan: stops of car i in words [0, w)
+    int stopsBeforeWord(size_t i, size_t w) const {
+        const int* tree = stopCounts[i].get().data();
+        int count = 0;
+        for (; w > 0; w &= w - 1) {
+            count += tree[w - 1];
+        }
+        return count;
+    }
+
+    // Scan: sets (add) or clears a stop bit that is known to be clear / set
+    void flipStop(size_t i, int floor, bool add) {
+        size_t w = static_cast<size_t>(floor) / 64;
+        stopBits[i].edit()[w] ^= uint64_t(1) << (floor % 64);
+        int* tree = stopCounts[i].edit().data();
+        for (size_t j = w + 1; j <= stopWords; j += j & (~j + 1)) {
+            tree[j - 1] += add ? 1 : -1;
+        }
+        if (add) {
+            topStop[i] = topStop[i] < 0 ? floor : max(topStop[i], floor);
+            bottomStop[i] = bottomStop[i] < 0 ? floor : min(bottomStop[i], floor);
+        } else {
+            if (floor == topStop[i]) {
+                topStop[i] = stopAtOrBelow(i, floor);
+            }
+            if (floor == bottomStop[i]) {
+                bottomStop[i] = stopAtOrAbove(i, floor);
+            }
+        }
+    }
+
+    // Scan: car i's lowest stop at or above `floor`, or -1
+    int stopAtOrAbove(size_t i, int floor) const {
+        const uint64_t* bits = stopBits[i].get().data();
+        size_t w = static_cast<size_t>(floor) / 64;
+        uint64_t word = bits[w] & (~uint64_t(0) << (floor % 64));
+        while (word == 0) {
+            if (++w == stopWords) {
+                return -1;
+            }
+            word = bits[w];
+        }
+        return static_cast<int>(w * 64) + __builtin_ctzll(word);
+    }
+
+    // Scan: car i's highest stop at or below `floor`, or -1
+    int stopAtOrBelow(size_t i, int floor) const {
+        const uint64_t* bits = stopBits[i].get().data();
+        size_t w = static_cast<size_t>(floor) / 64;
+        uint64_t word = bits[w] & (~uint64_t(0) >> (63 - floor % 64));
+        while (word == 0) {
+            if (w-- == 0) {
+                return -1;
+            }
+            word = bits[w];
+        }
+        return static_cast<int>(w * 64) + 63 - __builtin_clzll(word);
+    }
+
+    // Scan (LOOK): the nearest stop in the direction of travel, else the
+    // nearest behind; an idle car takes the closer side, up on ties.
+    int nextStop(size_t i) const {
+        int floor = currentFloor[i];
+        int above = stopAtOrAbove(i, floor);
+        int below = stopAtOrBelow(i, floor);
+        switch (getDirection(i)) {
+            case Direction::Up:
+                return above >= 0 ? above : below;
+            case Direction::Down:
+                return below >= 0 ? below : above;
+            default:
+                if (above < 0 || (below >= 0 && floor - below < above - floor)) {
+                    return below;
+                }
+                return above;
+        }
+    }
+
+    Direction getDirection(size_t i) const {
+        return static_cast<Direction>(direction[i]);
+    }
+
+    void setDirection(size_t i, Direction d) {
+        if (direction[i] != static_cast<int8_t>(d)) {
+            direction[i] = static_cast<int8_t>(d);
+            changed[i] = 1;
+        }
+    }
+
+    bool hasStop(size_t i, int floor) const {
+        if (order == StopOrder::Scan) {
+            return (stopBits[i][static_cast<size_t>(floor) / 64] >> (floor % 64)) & 1;
+        }
+        return targets[i].contains(floor);
+    }
+
+    // Number of car i's stops on floors lo..hi (0 when lo > hi). Repeated
+    // FIFO entries count once each.
+    int countStops(size_t i, int lo, int hi) const {
+        if (lo > hi) {
+            return 0;
+        }
+        if (order == StopOrder::Scan) {
+            const uint64_t* bits = stopBits[i].get().data();
+            size_t wl = static_cast<size_t>(lo) / 64;
+            size_t wh = static_cast<size_t>(hi) / 64;
+            uint64_t lowMask = ~uint64_t(0) << (lo % 64);
+            uint64_t highMask = ~uint64_t(0) >> (63 - hi % 64);
+            if (wl == wh) {
+                return __builtin_popcountll(bits[wl] & lowMask & highMask);
+            }
+            // Whole words in between come from the Fenwick tree
+            return __builtin_popcountll(bits[wl] & lowMask) +
+                   stopsBeforeWord(i, wh) - stopsBeforeWord(i, wl + 1) +
+                   __builtin_popcountll(bits[wh] & highMask);
+        }
+        return targets[i].countBetween(lo, hi);
+    }
+
+    // Highest / lowest stop of car i, or `otherwise` when it has none
+    int highestStop(size_t i, int otherwise) const {
+        if (order == StopOrder::Scan) {
+            return topStop[i] < 0 ? otherwise : topStop[i];
+        }
+        return targets[i].empty() ? otherwise : targets[i].highest();
+    }
+
+    int lowestStop(size_t i, int otherwise) const {
+        if (order == StopOrder::Scan) {
+            return bottomStop[i] < 0 ? otherwise : bottomStop[i];
+        }
+        return targets[i].empty() ? otherwise : targets[i].lowest();
+    }
+
+    // Car i's lowest stop above `floor`, or -1: with lowestStop(), walks
+    // the stops in floor order.
+    int stopAbove(size_t i, int floor) const {
+        if (order == StopOrder::Scan) {
+            return static_cast<size_t>(floor) + 1 < stopWords * 64 ? stopAtOrAbove(i, floor + 1)
+                                                                   : -1;
+        }
+        return targets[i].above(floor);
+    }
+
+    void addTarget(size_t i, int floor) {
+        if (order == StopOrder::Scan) {
+            if (hasStop(i, floor)) {
+                return; // already stopping there
+            }
+            flipStop(i, floor, true);
+            ++queueSize[i];
+            queueHead[i] = nextStop(i);
+            changed[i] = 1;
+            return;
+        }
+
+        TargetQueue& q = targets[i];
+        if (!q.empty() && q.back() == floor) {
+            return; // avoid duplicate consecutive target
+        }
+        if (!q.empty()) {
+            routeLegs[i] += abs(floor - q.back());
+        }
+        q.push_back(floor);
+        changed[i] = 1;
+        queueHead[i] = q.front();
+        ++queueSize[i];
+        if (2 * q.size() > q.capacity() && !crowded[i]) {
+            crowded[i] = 1;
+            ++crowdedRings;
+        }
+    }
+
+    // Doubles every target ring that filled past half since the last
+    // call. Called between ticks, so addTarget() inside a tick finds room.
+    void widenRings() {
+        for (size_t i = 0; crowdedRings > 0 && i < size(); ++i) {
+            if (crowded[i]) {
+                reserveStops(i, 2 * targets[i].capacity());
+                crowded[i] = 0;
+                --crowdedRings;
+            }
+        }
+    }
+
+    // Cancels every stop of car i at floor (a revoked hall call), merging
+    // FIFO neighbours that the removal leaves on the same floor. Returns
+    // false if car i had no stop there.
+    bool removeTarget(size_t i, int floor) {
+        size_t removed;
+        if (order == StopOrder::Scan) {
+            removed = hasStop(i, floor) ? 1 : 0;
+            if (removed) {
+                flipStop(i, floor, false);
+            }
+        } else {
+            revoked.clear();
+            int legs = 0;
+            removed = targets[i].removeAll(floor, revoked, legs);
+            if (removed) {
+                revokedLegs = routeLegs[i];
+                routeLegs[i] = legs;
+            }
+        }
+        if (removed == 0) {
+            return false;
+        }
+        queueSize[i] -= static_cast<int>(removed);
+        if (queueSize[i] > 0) {
+            queueHead[i] = order == StopOrder::Scan ? nextStop(i) : targets[i].front();
+        }
+        changed[i] = 1;
+        return true;
+    }
+
+    // Undoes the last removeTarget(i, floor), which returned true: the
+    // stops come back exactly as they were.
+    void restoreTarget(size_t i, int floor) {
+        if (order == StopOrder::Scan) {
+            addTarget(i, floor);
+            return;
+        }
+        targets[i].insertAll(floor, revoked);
+        routeLegs[i] = revokedLegs;
+        queueHead[i] = targets[i].front();
+        queueSize[i] += static_cast<int>(revoked.size());
+        changed[i] = 1;
+    }
+
+    // Room for n FIFO stops on car i without growing inside a tick.
+    void reserveStops(size_t i, size_t n) {
+        targets[i].reserve(n);
+        revoked.reserve(targets[i].capacity());
+    }
+
+    void popTarget(size_t i) {
+        changed[i] = 1;
+        if (order == StopOrder::Scan) {
+            flipStop(i, queueHead[i], false);
+            if (--queueSize[i] > 0) {
+                queueHead[i] = nextStop(i);
+            }
+            return;
+        }
+
+        TargetQueue& q = targets[i];
+        if (q.size() > 1) {
+            routeLegs[i] -= abs(q.at(1) - q.front());
+        }
+        q.pop_front();
+        if (!q.empty()) {
+            queueHead[i] = q.front();
+        }
+        --queueSize[i];
+    }
+
+    // Whether car i's state could have been produced by this fleet in a
+    // building of `floors`: fields in range and the stop summaries
+    // matching the stops. Used to vet restored snapshots.
+    bool consistent(size_t i, int floors) const {
+        auto onFloor = [floors](int f) { return f >= 0 && f < floors; };
+        if (!onFloor(currentFloor[i]) || direction[i] < 0 || direction[i] > 2 ||
+            doorOpen[i] > 1 || changed[i] > 1 || outOfService[i] > 1 || queueSize[i] < 0 ||
+            (queueSize[i] > 0 && !onFloor(queueHead[i]))) {
+            return false;
+        }
+
+        if (order == StopOrder::Fifo) {
+            const TargetQueue& q = targets[i];
+            if (q.size() != static_cast<size_t>(queueSize[i]) ||
+                (!q.empty() && (q.front() != queueHead[i] || !onFloor(q.lowest()) ||
+                                !onFloor(q.highest())))) {
+                return false;
+            }
+            int legs = 0;
+            for (size_t k = 1; k < q.size(); ++k) {
+                legs += abs(q.at(k) - q.at(k - 1));
+            }
+            return legs == routeLegs[i];
+        }
+
+        const uint64_t* bits = stopBits[i].get().data();
+        if (floors % 64 != 0 && (bits[stopWords - 1] >> (floors % 64)) != 0) {
+            return false;   // a stop above the top floor
+        }
+        const int* tree = stopCounts[i].get().data();
+        int stops = 0;
+        for (size_t j = 1; j <= stopWords; ++j) {
+            // Fenwick node j covers words (j - lowbit(j), j]
+            int covered = 0;
+            for (size_t w = j - (j & (~j + 1)); w < j; ++w) {
+                covered += __builtin_popcountll(bits[w]);
+            }
+            if (tree[j - 1] != covered) {
+                return false;
+            }
+            stops += __builtin_popcountll(bits[j - 1]);
+        }
+        return stops == queueSize[i] &&
+               topStop[i] == (stops ? stopAtOrBelow(i, floors - 1) : -1) &&
+               bottomStop[i] == (stops ? stopAtOrAbove(i, 0) : -1) &&
+               (stops == 0 || hasStop(i, queueHead[i]));
+    }
+
+    bool isIdle(size_t i) const {
+        return queueSize[i] == 0 && !doorOpen[i] &&
+               direction[i] == static_cast<int8_t>(Direction::Idle);
+    }
+
+    /*
+       step() simulates one time unit for car i:
+       - If door is open → close it and finish the stop
+       - If no targets → stay idle
+       - Otherwise → move one floor toward next target
+       Returns true if the door opened during this step.
+    */
+    bool step(size_t i) {
+        // If door is open, close it and complete this stop
+        if (doorOpen[i]) {
+            doorOpen[i] = 0;
+            changed[i] = 1;
+            ++totalStopsServed[i];
+
+            if (queueSize[i] > 0 && queueHead[i] == currentFloor[i]) {
+                popTarget(i);
+            }
+
+            if (queueSize[i] == 0) {
+                setDirection(i, Direction::Idle);
+            }
+            return false;
+        }
+
+        // No targets -> stay idle
+        if (queueSize[i] == 0) {
+            setDirection(i, Direction::Idle);
+            return false;
+        }
+
+        // Move toward the first target in the queue
+        int target = queueHead[i];
+
+        if (currentFloor[i] < target) {
+            ++currentFloor[i];
+            ++floorsTraveled[i];
+            changed[i] = 1;
+            setDirection(i, Direction::Up);
+        }
+        else if (currentFloor[i] > target) {
+            --currentFloor[i];
+            ++floorsTraveled[i];
+            changed[i] = 1;
+            setDirection(i, Direction::Down);
+        }
+        else {
+            // Arrived at target -> open door
+            doorOpen[i] = 1;
+            changed[i] = 1;
+            return true;
+        }
+        return false;
+    }
+
+    // Number of ticks until car i next opens or closes its door, or -1 if
+    // it is waiting for work and nothing will change on its own.
+    int ticksToNextEvent(size_t i) const {
+        if (doorOpen[i]) {
+            return 1;
+        }
+        if (queueSize[i] == 0) {
+            return -1;
+        }
+        return abs(queueHead[i] - currentFloor[i]) + 1;
+    }
+
+    // Same result as calling step(i) `ticks` times, but straight runs
+    // between stops are covered in one jump.
+    void advance(size_t i, int ticks) {
+        while (ticks > 0) {
+            if (!doorOpen[i] && queueSize[i] == 0) {
+                setDirection(i, Direction::Idle);
+                return;
+            }
+            int dist = doorOpen[i] ? 0 : queueHead[i] - currentFloor[i];
+            if (dist == 0) {
+                step(i);
+                --ticks;
+                continue;
+            }
+            int moves = min(abs(dist), ticks);
+            currentFloor[i] += dist > 0 ? moves : -moves;
+            floorsTraveled[i] += moves;
+            changed[i] = 1;
+            setDirection(i, dist > 0 ? Direction::Up : Direction::Down);
+            ticks -= moves;
+        }
+    }
+};
+
+// ================== Elevator ==================
+
+// Lightweight handle onto one car of an ElevatorFleet.
+class Elevator {
+private:
+    ElevatorFleet* fleet;
+    int id;
+
+public:
+    Elevator(ElevatorFleet& fleet_, int id_) : fleet(&fleet_), id(id_) {}
+
+    int getId() const { return id; }
+    int getCurrentFloor() const { return fleet->currentFloor[id]; }
+    Direction getDirection() const { return fleet->getDirection(id); }
+    bool isDoorOpen() const { return fleet->doorOpen[id] != 0; }
+    int getQueueSize() const { return fleet->queueSize[id]; }
+    int getTotalStopsServed() const { return fleet->totalStopsServed[id]; }
+
+    void addTarget(int floor) { fleet->addTarget(id, floor); }
+    bool isIdle() const { return fleet->isIdle(id); }
+
+    int distanceToFloor(int floor) const {
+        return abs(floor - getCurrentFloor());
+    }
+
+    void step() { fleet->step(id); }
+
+    void printStatus() const {
+        cout << "Elevator " << id
+             << " | Floor: " << getCurrentFloor()
+             << " | Dir: " << directionToString(getDirection())
+             << " | Door: " << (isDoorOpen() ? "Open" : "Closed")
+             << " | Queue size: " << getQueueSize()
+             << '\n';
+    }
+};
+
+// ================== Logging ==================
+
+enum class LogFormat {
+    Text,
+    Binary
+};
+
+// What the simulation thread does when the async log ring is full.
+enum class LogOverflow {
+    Drop,           // discard the record and count it
+    Block           // wait for the writer thread to make room
+};
+
+enum class LogRecordKind : uint8_t {
+    Status,         // one elevator at one tick
+    IdleSpan,       // every elevator idle and unchanged for ticks [time, floor]
+    End,            // simulation ended at `time`
+    Keyframe        // delta logs: every elevator's Status for `time` follows
+};
+
+/*
+   Fixed-width binary log record (16 bytes, host byte order). Status
+   records carry one elevator's state; the other kinds reuse the fields
+   as documented on LogRecordKind.
+*/
+struct LogRecord {
+    int32_t time;
+    uint16_t elevator;
+    uint8_t kind;           // LogRecordKind
+    uint8_t flags;          // bit 0: door open; bits 1-2: Direction
+    int32_t floor;
+    uint32_t queueSize;
+
+    static const uint8_t DOOR_OPEN = 1;
+
+    static LogRecord status(int time, int elevator, int floor, Direction dir,
+                            bool doorOpen, int queueSize) {
+        LogRecord r;
+        r.time = time;
+        r.elevator = static_cast<uint16_t>(elevator);
+        r.kind = static_cast<uint8_t>(LogRecordKind::Status);
+        r.flags = static_cast<uint8_t>((doorOpen ? DOOR_OPEN : 0) |
+                                       (static_cast<int>(dir) << 1));
+        r.floor = floor;
+        r.queueSize = static_cast<uint32_t>(queueSize);
+        return r;
+    }
+
+    LogRecordKind getKind() const { return static_cast<LogRecordKind>(kind); }
+    Direction getDirection() const { return static_cast<Direction>((flags >> 1) & 3); }
+    bool isDoorOpen() const { return (flags & DOOR_OPEN) != 0; }
+};
+
+static_assert(sizeof(LogRecord) == 16, "LogRecord must stay 16 bytes");
+
+// Binary log header; numElevators tells a reader how many Status records
+// make up one tick. Version 1 files end after numElevators.
+struct LogHeader {
+    char magic[4];          // "ELOG"
+    uint32_t version;
+    int32_t numFloors;
+    int32_t numElevators;
+    int32_t keyframeInterval;   // 0 for full logs, otherwise a delta log
+    int32_t reserved;
+
+    static const uint32_t VERSION = 2;
+    static const size_t V1_SIZE = 16;
+};
+
+static_assert(sizeof(LogHeader) == 24, "LogHeader must stay 24 bytes");
+
+const char LOG_TEXT_TITLE[] = "Elevator Simulation Log\n";
+
+// Title of a text delta log; the numbers are filled in with snprintf
+const char LOG_TEXT_DELTA_TITLE[] =
+    "Elevator Simulation Log (delta: %d elevators, keyframe every %d ticks)\n";
+
+struct LogOptions {
+    LogFormat format = LogFormat::Text;
+    int keyframeInterval = 0;       // > 0: log changes only, full state this often
+    size_t asyncRing = 0;           // > 0: background writer with a ring this big
+    LogOverflow overflow = LogOverflow::Block;
+};
+
+// The text rendering of a record, shared by the text log and the converter.
+void writeTextRecord(ostream& out, const LogRecord& r, int numElevators) {
+    switch (r.getKind()) {
+        case LogRecordKind::Status:
+            out << "t=" << r.time
+                << " Elevator " << r.elevator
+                << " Floor=" << r.floor
+                << " Dir=" << directionName(r.getDirection())
+                << " Door=" << (r.isDoorOpen() ? "Open" : "Closed")
+                << " QueueSize=" << r.queueSize
+                << "\n";
+            break;
+        case LogRecordKind::IdleSpan:
+            out << "t=" << r.time << ".." << r.floor
+                << " All " << numElevators << " elevators idle, state unchanged\n";
+            break;
+        case LogRecordKind::End:
+            out << "Simulation ended. Total time steps: " << r.time << "\n";
+            break;
+        case LogRecordKind::Keyframe:
+            out << "t=" << r.time << " Keyframe\n";
+            break;
+    }
+}
+
+/*
+   Bounded single-producer/single-consumer ring buffer. The producer only
+   writes `head` and the consumer only writes `tail`, so no locks are
+   needed; each side caches the other's index to keep the shared cache
+   lines quiet. Capacity is rounded up to a power of two.
+*/
+template <typename T>
+class SpscRing {
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head;    // next slot to fill (producer)
+    size_t cachedTail;                  // producer's view of tail
+    alignas(64) atomic<size_t> tail;    // next slot to drain (consumer)
+    size_t cachedHead;                  // consumer's view of head
+
+public:
+    explicit SpscRing(size_t capacity)
+        : head(0), cachedTail(0), tail(0), cachedHead(0)
+    {
+        size_t cap = 2;
+        while (cap < capacity) {
+            cap *= 2;
+        }
+        slots.resize(cap);
+        mask = cap - 1;
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    // Producer side. Returns false when the ring is full; on success
+    // `used` receives the occupancy after the push.
+    bool tryPush(const T& value, size_t& used) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h - cachedTail == slots.size()) {
+            cachedTail = tail.load(memory_order_acquire);
+            if (h - cachedTail == slots.size()) {
+                return false;
+            }
+        }
+        slots[h & mask] = value;
+        head.store(h + 1, memory_order_release);
+        used = h + 1 - cachedTail;
+        return true;
+    }
+
+    // Consumer side: hands every available element to fn, then frees them
+    // all at once. Returns how many were drained.
+    template <typename Fn>
+    size_t drain(Fn fn) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t == cachedHead) {
+            cachedHead = head.load(memory_order_acquire);
+            if (t == cachedHead) {
+                return 0;
+            }
+        }
+        for (size_t k = t; k != cachedHead; ++k) {
+            fn(slots[k & mask]);
+        }
+        tail.store(cachedHead, memory_order_release);
+        return cachedHead - t;
+    }
+};
+
+/*
+   SimLog is the simulation's log sink. In Text format every record is
+   formatted as it arrives; in Binary format records are batched in memory
+   and written as raw LogRecords behind a LogHeader, leaving the text
+   rendering to convertLog().
+
+   After startAsync() the caller only pushes records into an SPSC ring; a
+   background writer thread does all formatting and file I/O.
+
+   With a keyframe interval, Status records equal to the elevator's last
+   logged state are filtered out on the caller's side, and every interval
+   ticks a Keyframe record is followed by the full state of every car.
+*/
+class SimLog {
+private:
+    static const size_t BATCH_RECORDS = 4096;
+
+    ofstream out;
+    LogFormat format;
+    int numElevators;
+    vector<LogRecord> batch;
+
+    // Delta mode
+    int keyframeInterval;
+    vector<LogRecord> lastLogged;   // per elevator
+    int deltaTick;                  // tick whose records are arriving
+    bool keyframeTick;              // ... and whether it is a keyframe
+    int nextKeyframe;
+
+    // Async mode
+    unique_ptr<SpscRing<LogRecord>> ring;
+    LogOverflow overflow;
+    thread writer;
+    atomic<bool> stopping;
+    long long dropped;
+    size_t highWater;
+
+    void flushBatch() {
+        if (!batch.empty()) {
+            out.write(reinterpret_cast<const char*>(batch.data()),
+                      static_cast<streamsize>(batch.size() * sizeof(LogRecord)));
+            batch.clear();
+        }
+    }
+
+    void writeNow(const LogRecord& r) {
+        if (format == LogFormat::Binary) {
+            batch.push_back(r);
+            if (batch.size() == BATCH_RECORDS) {
+                flushBatch();
+            }
+        } else {
+            writeTextRecord(out, r, numElevators);
+        }
+    }
+
+    void writerLoop() {
+        auto sink = [this](const LogRecord& r) { writeNow(r); };
+        for (;;) {
+            // Read the flag before draining so nothing pushed earlier is lost
+            bool last = stopping.load(memory_order_acquire);
+            if (ring->drain(sink) == 0) {
+                if (last) {
+                    break;
+                }
+                this_thread::sleep_for(chrono::microseconds(100));
+            }
+        }
+    }
+
+public:
+    // Returns false if the record was dropped (LogOverflow::Drop).
+    bool enqueue(const LogRecord& r) {
+        if (!ring) {
+            writeNow(r);
+            return true;
+        }
+
+        size_t used = 0;
+        while (!ring->tryPush(r, used)) {
+            if (overflow == LogOverflow::Drop) {
+                ++dropped;
+                return false;
+            }
+            this_thread::yield();
+        }
+        highWater = max(highWater, used);
+        return true;
+    }
+
+    static bool sameState(const LogRecord& a, const LogRecord& b) {
+        return a.floor == b.floor && a.flags == b.flags && a.queueSize == b.queueSize;
+    }
+
+    void writeDelta(const LogRecord& r) {
+        if (r.time != deltaTick) {
+            deltaTick = r.time;
+            keyframeTick = r.time >= nextKeyframe;
+            if (keyframeTick) {
+                LogRecord k = r;
+                k.kind = static_cast<uint8_t>(LogRecordKind::Keyframe);
+                enqueue(k);
+                nextKeyframe = r.time + keyframeInterval;
+            }
+        }
+
+        // A dropped record leaves `last` as the replayer still has it, so
+        // the car's state is sent again on its next tick
+        LogRecord& last = lastLogged[r.elevator];
+        if ((keyframeTick || !sameState(last, r)) && enqueue(r)) {
+            last = r;
+        }
+    }
+
+public:
+    SimLog()
+        : format(LogFormat::Text), numElevators(0),
+          keyframeInterval(0), deltaTick(-1), keyframeTick(false), nextKeyframe(0),
+          overflow(LogOverflow::Block), stopping(false),
+          dropped(0), highWater(0) {}
+
+    ~SimLog() { close(-1); }
+
+    bool open(const string& path, const LogOptions& opts, int floors, int elevators) {
+        format = opts.format;
+        numElevators = elevators;
+        keyframeInterval = max(0, opts.keyframeInterval);
+        out.open(path, format == LogFormat::Binary ? ios::out | ios::binary : ios::out);
+        if (!out.is_open()) {
+            return false;
+        }
+
+        if (format == LogFormat::Binary) {
+            LogHeader h = {{'E', 'L', 'O', 'G'}, LogHeader::VERSION, floors, elevators,
+                           keyframeInterval, 0};
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            batch.reserve(BATCH_RECORDS);
+        } else if (keyframeInterval > 0) {
+            char title[128];
+            snprintf(title, sizeof(title), LOG_TEXT_DELTA_TITLE, elevators, keyframeInterval);
+            out << title;
+        } else {
+            out << LOG_TEXT_TITLE;
+        }
+
+        if (keyframeInterval > 0) {
+            lastLogged.assign(elevators, LogRecord());
+        }
+        if (opts.asyncRing > 0) {
+            startAsync(opts.asyncRing, opts.overflow);
+        }
+        return true;
+    }
+
+    // Moves all file I/O to a writer thread fed through a ring of
+    // `capacity` records. Call once, after open().
+    void startAsync(size_t capacity, LogOverflow policy) {
+        if (!out.is_open() || ring) {
+            return;
+        }
+        ring.reset(new SpscRing<LogRecord>(capacity));
+        overflow = policy;
+        writer = thread(&SimLog::writerLoop, this);
+    }
+
+    bool isOpen() const { return out.is_open(); }
+    bool isAsync() const { return ring != nullptr; }
+    long long getDropped() const { return dropped; }
+    size_t getHighWater() const { return highWater; }
+    size_t getRingCapacity() const { return ring ? ring->capacity() : 0; }
+
+    void write(const LogRecord& r) {
+        if (keyframeInterval > 0 && r.getKind() == LogRecordKind::Status) {
+            writeDelta(r);
+        } else {
+            enqueue(r);
+        }
+    }
+
+    void idleSpan(int from, int to) {
+        LogRecord r = LogRecord::status(from, 0, to, Direction::Idle, false, 0);
+        r.kind = static_cast<uint8_t>(LogRecordKind::IdleSpan);
+        write(r);
+    }
+
+    // Writes the End record (unless finalTime < 0), drains the writer
+    // thread if there is one, and closes the file.
+    void close(int finalTime) {
+        if (!out.is_open()) {
+            return;
+        }
+        if (finalTime >= 0) {
+            LogRecord r = LogRecord::status(finalTime, 0, 0, Direction::Idle, false, 0);
+            r.kind = static_cast<uint8_t>(LogRecordKind::End);
+            if (ring) {
+                // The end marker must never be dropped
+                LogOverflow policy = overflow;
+                overflow = LogOverflow::Block;
+                write(r);
+                overflow = policy;
+            } else {
+                write(r);
+            }
+        }
+        if (writer.joinable()) {
+            stopping.store(true, memory_order_release);
+            writer.join();
+        }
+        flushBatch();
+        out.close();
+    }
+};
+
+// Reads records back from a binary log or a text delta log.
+class LogReader {
+private:
+    ifstream in;
+    bool binary;
+    int numElevators;
+    int keyframeInterval;
+    vector<LogRecord> chunk;
+    size_t chunkPos;
+    size_t chunkLen;
+
+    bool nextBinary(LogRecord& r) {
+        if (chunkPos == chunkLen) {
+            in.read(reinterpret_cast<char*>(chunk.data()),
+                    static_cast<streamsize>(chunk.size() * sizeof(LogRecord)));
+            chunkLen = static_cast<size_t>(in.gcount()) / sizeof(LogRecord);
+            chunkPos = 0;
+            if (chunkLen == 0) {
+                return false;
+            }
+        }
+        r = chunk[chunkPos++];
+        return true;
+    }
+
+    bool nextText(LogRecord& r) {
+        string line;
+        while (getline(in, line)) {
+            int t = 0, e = 0, floor = 0, to = 0, n = 0;
+            unsigned queue = 0;
+            char dir[8] = {0}, door[8] = {0};
+
+            if (sscanf(line.c_str(), "t=%d Elevator %d Floor=%d Dir=%7s Door=%7s QueueSize=%u",
+                       &t, &e, &floor, dir, door, &queue) == 6) {
+                Direction d = strcmp(dir, "Up") == 0   ? Direction::Up
+                            : strcmp(dir, "Down") == 0 ? Direction::Down
+                                                       : Direction::Idle;
+                r = LogRecord::status(t, e, floor, d, strcmp(door, "Open") == 0,
+                                      static_cast<int>(queue));
+                return true;
+            }
+            if (sscanf(line.c_str(), "t=%d..%d All %d", &t, &to, &n) == 3) {
+                r = LogRecord::status(t, 0, to, Direction::Idle, false, 0);
+                r.kind = static_cast<uint8_t>(LogRecordKind::IdleSpan);
+                return true;
+            }
+            if (line.find("Keyframe") != string::npos && sscanf(line.c_str(), "t=%d", &t) == 1) {
+                r = LogRecord::status(t, 0, 0, Direction::Idle, false, 0);
+                r.kind = static_cast<uint8_t>(LogRecordKind::Keyframe);
+                return true;
+            }
+            if (sscanf(line.c_str(), "Simulation ended. Total time steps: %d", &t) == 1) {
+                r = LogRecord::status(t, 0, 0, Direction::Idle, false, 0);
+                r.kind = static_cast<uint8_t>(LogRecordKind::End);
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    LogReader()
+        : binary(false), numElevators(0), keyframeInterval(0),
+          chunk(4096), chunkPos(0), chunkLen(0) {}
+
+    // Accepts binary logs (full or delta) and text delta logs.
+    bool open(const string& path) {
+        in.open(path, ios::binary);
+        if (!in.is_open()) {
+            cerr << "Cannot read " << path << "\n";
+            return false;
+        }
+
+        LogHeader h;
+        memset(&h, 0, sizeof(h));
+        if (in.read(reinterpret_cast<char*>(&h), LogHeader::V1_SIZE) &&
+            memcmp(h.magic, "ELOG", 4) == 0) {
+            if (h.version > LogHeader::VERSION ||
+                (h.version >= 2 && !in.read(reinterpret_cast<char*>(&h) + LogHeader::V1_SIZE,
+                                            sizeof(h) - LogHeader::V1_SIZE))) {
+                cerr << path << ": unsupported log version " << h.version << "\n";
+                return false;
+            }
+            binary = true;
+            numElevators = h.numElevators;
+            keyframeInterval = h.keyframeInterval;
+            return true;
+        }
+
+        in.clear();
+        in.seekg(0);
+        string title;
+        getline(in, title);
+        if (sscanf(title.c_str(), "Elevator Simulation Log (delta: %d elevators, keyframe every %d",
+                   &numElevators, &keyframeInterval) == 2) {
+            return true;
+        }
+        cerr << path << " is neither a binary log nor a delta text log.\n";
+        return false;
+    }
+
+    int getNumElevators() const { return numElevators; }
+    int getKeyframeInterval() const { return keyframeInterval; }
+
+    bool next(LogRecord& r) {
+        return binary ? nextBinary(r) : nextText(r);
+    }
+};
+
+/*
+   Renders a binary or delta log as the full text log the same run would
+   have written without --log-format binary / --log-delta. Delta logs are
+   replayed: every car's state is carried forward from its last change
+   and each stepped tick gets a line per car again. Ticks before the first
+   keyframe cannot be reconstructed and are skipped.
+*/
+bool convertLog(const string& inPath, const string& outPath) {
+    LogReader reader;
+    if (!reader.open(inPath)) {
+        return false;
+    }
+
+    ofstream out(outPath);
+    if (!out.is_open()) {
+        cerr << "Cannot write " << outPath << "\n";
+        return false;
+    }
+    out << LOG_TEXT_TITLE;
+
+    const int n = reader.getNumElevators();
+    LogRecord r;
+
+    if (reader.getKeyframeInterval() == 0) {
+        while (reader.next(r)) {
+            writeTextRecord(out, r, n);
+        }
+        return true;
+    }
+
+    vector<LogRecord> state(n);
+    bool seeded = false;
+    int written = 0;            // last tick whose lines are out
+    int pending = 0;            // tick whose changes are being collected
+
+    auto flushThrough = [&](int last) {
+        for (int t = written + 1; t <= last; ++t) {
+            for (LogRecord& car : state) {
+                car.time = t;
+                writeTextRecord(out, car, n);
+            }
+        }
+        written = max(written, last);
+    };
+
+    while (reader.next(r)) {
+        switch (r.getKind()) {
+            case LogRecordKind::Keyframe:
+                if (seeded) {
+                    flushThrough(r.time - 1);
+                } else {
+                    seeded = true;
+                    written = r.time - 1;
+                }
+                pending = r.time;
+                break;
+
+            case LogRecordKind::Status:
+                if (!seeded || r.elevator >= n) {
+                    break;
+                }
+                if (r.time != pending) {
+                    flushThrough(r.time - 1);
+                    pending = r.time;
+                }
+                state[r.elevator] = r;
+                break;
+
+            case LogRecordKind::IdleSpan:
+                if (seeded) {
+                    flushThrough(r.time - 1);
+                    written = max(written, r.floor);
+                    pending = r.floor;
+                }
+                writeTextRecord(out, r, n);
+                break;
+
+            case LogRecordKind::End:
+                if (seeded) {
+                    flushThrough(r.time);
+                }
+                writeTextRecord(out, r, n);
+                break;
+        }
+    }
+    return true;
+}
+
+// ================== Scoring kernels ==================
+
+/*
+   A scoring kernel rates one hall call against every car and returns the
+   index of the lowest score, the first one on ties (-1 for no cars):
+
+       score = |fromFloor - floor| + directionPenalty * headingAway
+               + queueWeight * queueSize
+
+   where headingAway means moving Up above the caller or Down below it.
+*/
+struct DispatchParams {
+    int directionPenalty = 5;
+    int queueWeight = 1;
+};
+
+typedef int (*ScoreKernel)(const int* floors, const int8_t* dirs,
+                           const int* queueSizes, size_t n, int fromFloor,
+                           const DispatchParams& params);
+
+// Below this many cars the vector kernels' lane reduction costs more
+// than it saves, and so does the indirect call to reach them.
+const size_t SCALAR_SCORING_MAX_CARS = 16;
+
+inline int scoreCar(int floor, int8_t dir, int queueSize, int fromFloor,
+                    const DispatchParams& params) {
+    // Branch-free direction test: at most one of the two terms can be set
+    int headingAway = (dir == static_cast<int8_t>(Direction::Up) && fromFloor < floor) |
+                      (dir == static_cast<int8_t>(Direction::Down) && fromFloor > floor);
+    return abs(fromFloor - floor) + params.directionPenalty * headingAway +
+           params.queueWeight * queueSize;
+}
+
+inline int scoreCarsScalar(const int* floors, const int8_t* dirs,
+                           const int* queueSizes, size_t n, int fromFloor,
+                           const DispatchParams& params) {
+    int bestIndex = -1;
+    int bestScore = numeric_limits<int>::max();
+    for (size_t i = 0; i < n; ++i) {
+        int score = scoreCar(floors[i], dirs[i], queueSizes[i], fromFloor, params);
+        if (score < bestScore) {
+            bestScore = score;
+            bestIndex = static_cast<int>(i);
+        }
+    }
+    return bestIndex;
+}
+
+#ifdef ELEVATOR_HAVE_AVX2_KERNEL
+// Eight cars per iteration. Each lane keeps its own running minimum and the
+// index it came from; the lanes are reduced at the end with ties going to
+// the lower index, so the result matches scoreCarsScalar() exactly.
+__attribute__((target("avx2")))
+int scoreCarsAvx2(const int* floors, const int8_t* dirs,
+                  const int* queueSizes, size_t n, int fromFloor,
+                  const DispatchParams& params) {
+    if (n < SCALAR_SCORING_MAX_CARS) {
+        return scoreCarsScalar(floors, dirs, queueSizes, n, fromFloor, params);
+    }
+
+    const __m256i from = _mm256_set1_epi32(fromFloor);
+    const __m256i up = _mm256_set1_epi32(static_cast<int>(Direction::Up));
+    const __m256i down = _mm256_set1_epi32(static_cast<int>(Direction::Down));
+    const __m256i penalty = _mm256_set1_epi32(params.directionPenalty);
+    const __m256i queueWeight = _mm256_set1_epi32(params.queueWeight);
+    const __m256i eight = _mm256_set1_epi32(8);
+
+    __m256i bestScore = _mm256_set1_epi32(numeric_limits<int>::max());
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i floor = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(floors + i));
+        __m256i dir = _mm256_cvtepi8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(dirs + i)));
+        __m256i queue = _mm256_mullo_epi32(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(queueSizes + i)), queueWeight);
+
+        __m256i upAway = _mm256_and_si256(_mm256_cmpeq_epi32(dir, up),
+                                          _mm256_cmpgt_epi32(floor, from));
+        __m256i downAway = _mm256_and_si256(_mm256_cmpeq_epi32(dir, down),
+                                            _mm256_cmpgt_epi32(from, floor));
+        __m256i away = _mm256_and_si256(_mm256_or_si256(upAway, downAway), penalty);
+
+        __m256i score = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_abs_epi32(_mm256_sub_epi32(from, floor)), away), queue);
+
+        __m256i better = _mm256_cmpgt_epi32(bestScore, score);
+        bestScore = _mm256_blendv_epi8(bestScore, score, better);
+        bestIndex = _mm256_blendv_epi8(bestIndex, index, better);
+        index = _mm256_add_epi32(index, eight);
+    }
+
+    alignas(32) int laneScore[8];
+    alignas(32) int laneIndex[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(laneScore), bestScore);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(laneIndex), bestIndex);
+
+    int best = -1;
+    int bestValue = numeric_limits<int>::max();
+    for (int lane = 0; lane < 8; ++lane) {
+        if (laneIndex[lane] < 0) {
+            continue;
+        }
+        if (laneScore[lane] < bestValue ||
+            (laneScore[lane] == bestValue && laneIndex[lane] < best)) {
+            bestValue = laneScore[lane];
+            best = laneIndex[lane];
+        }
+    }
+
+    // Remaining cars have higher indices, so a strict compare keeps first-min
+    for (; i < n; ++i) {
+        int score = scoreCar(floors[i], dirs[i], queueSizes[i], fromFloor, params);
+        if (score < bestValue) {
+            bestValue = score;
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+#endif
+
+// Picks the widest kernel the running CPU supports.
+ScoreKernel defaultScoreKernel() {
+#ifdef ELEVATOR_HAVE_AVX2_KERNEL
+    if (__builtin_cpu_supports("avx2")) {
+        return scoreCarsAvx2;
+    }
+#endif
+    return scoreCarsScalar;
+}
+
+// Runs `kernel`, except on small fleets, which are scored inline.
+inline int scoreCars(ScoreKernel kernel, const int* floors, const int8_t* dirs,
+                     const int* queueSizes, size_t n, int fromFloor,
+                     const DispatchParams& params) {
+    if (n < SCALAR_SCORING_MAX_CARS) {
+        return scoreCarsScalar(floors, dirs, queueSizes, n, fromFloor, params);
+    }
+    return kernel(floors, dirs, queueSizes, n, fromFloor, params);
+}
+
+// ================== Dispatch policies ==================
+
+/*
+   A dispatch policy picks the car for one hall call. Any type with
+
+       int cost(const ElevatorFleet& fleet, size_t car, const Request& req) const
+       int choose(const ElevatorFleet& fleet, const Request& req) const
+       bool stopsOnlyAddCost() const
+
+   will do: choose() returns the car with the lowest cost (or -1 to leave
+   the call pending), cost() feeds batch assignment and reassignment, and
+   stopsOnlyAddCost() says that withdrawing one of a car's stops never
+   raises its cost, which lets reassignment skip the withdrawal. The
+   policies are template arguments of ElevatorSystem::assignWith(), so the
+   chosen one is inlined into the assignment loop; DispatchPolicy names
+   them for run-time selection, at the cost of one switch per tick.
+*/
+enum class DispatchPolicy {
+    Nearest,        // closest car, whatever it is doing
+    Heuristic,      // distance + direction penalty + queue weight (kernels)
+    Collective,     // distance along each car's LOOK route
+    Eta,            // estimated ticks until the car could open at the caller
+    Destination     // ETA plus the delay new stops impose on the car
+};
+
+const int STOP_TICKS = 2;   // a stop costs one tick to open, one to close
+
+// Index of the car in service with the lowest cost(i), the first one on
+// ties.
+template <typename Cost>
+inline int argminCar(const ElevatorFleet& fleet, Cost cost) {
+    int best = -1;
+    int bestCost = numeric_limits<int>::max();
+    for (size_t i = 0; i < fleet.size(); ++i) {
+        if (fleet.outOfService[i]) {
+            continue;
+        }
+        int c = cost(i);
+        if (c < bestCost) {
+            bestCost = c;
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+// Floors car i covers before reaching `floor` when it keeps its direction
+// of travel until its last stop that way, then turns (LOOK).
+inline int lookDistance(const ElevatorFleet& fleet, size_t i, int floor) {
+    int at = fleet.currentFloor[i];
+    switch (fleet.getDirection(i)) {
+        case Direction::Up: {
+            if (floor >= at) {
+                return floor - at;
+            }
+            int top = max(at, fleet.highestStop(i, at));
+            return (top - at) + (top - floor);
+        }
+        case Direction::Down: {
+            if (floor <= at) {
+                return at - floor;
+            }
+            int bottom = min(at, fleet.lowestStop(i, at));
+            return (at - bottom) + (floor - bottom);
+        }
+        default:
+            return abs(floor - at);
+    }
+}
+
+/*
+   Ticks until car i could open its door at `floor` if that floor were
+   added as a stop now. FIFO cars finish their queue first; SCAN cars
+   follow their LOOK route and serve every stop passed on the way. Reads
+   only the fleet's cached route summaries: O(1) for FIFO, O(log floors)
+   for SCAN, whatever the number of stops.
+*/
+inline int etaTo(const ElevatorFleet& fleet, size_t i, int floor) {
+    int at = fleet.currentFloor[i];
+    bool serving = fleet.doorOpen[i] != 0;
+    int eta = serving ? 1 : 0;   // finish closing
+
+    if (fleet.order == StopOrder::Fifo) {
+        const TargetQueue& q = fleet.targets[i];
+        if (q.empty()) {
+            return eta + abs(floor - at) + 1;
+        }
+        // A stop being served now costs no further dwell
+        int stops = static_cast<int>(q.size()) - (serving && q.front() == at ? 1 : 0);
+        return eta + abs(q.front() - at) + fleet.routeLegs[i] + STOP_TICKS * stops +
+               abs(floor - q.back()) + 1;
+    }
+
+    int stops;
+    switch (fleet.getDirection(i)) {
+        case Direction::Up:
+            stops = floor >= at ? fleet.countStops(i, at, floor - 1)
+                                : fleet.countStops(i, floor + 1, fleet.highestStop(i, at));
+            break;
+        case Direction::Down:
+            stops = floor <= at ? fleet.countStops(i, floor + 1, at)
+                                : fleet.countStops(i, fleet.lowestStop(i, at), floor - 1);
+            break;
+        default:
+            stops = floor >= at ? fleet.countStops(i, at, floor - 1)
+                                : fleet.countStops(i, floor + 1, at);
+            break;
+    }
+    if (serving && fleet.hasStop(i, at)) {
+        --stops;    // already being served
+    }
+    return eta + lookDistance(fleet, i, floor) + STOP_TICKS * max(0, stops) + 1;
+}
+
+struct NearestCarPolicy {
+    int cost(const ElevatorFleet& fleet, size_t i, const Request& req) const {
+        return abs(fleet.currentFloor[i] - req.fromFloor);
+    }
+
+    int choose(const ElevatorFleet& fleet, const Request& req) const {
+        return argminCar(fleet, [&](size_t i) { return cost(fleet, i, req); });
+    }
+
+    bool stopsOnlyAddCost() const { return true; }
+};
+
+// The original direction-aware score, run through a (SIMD) scoring kernel.
+struct HeuristicPolicy {
+    ScoreKernel kernel;
+    DispatchParams params;
+
+    int cost(const ElevatorFleet& fleet, size_t i, const Request& req) const {
+        return scoreCar(fleet.currentFloor[i], fleet.direction[i], fleet.queueSize[i],
+                        req.fromFloor, params);
+    }
+
+    int choose(const ElevatorFleet& fleet, const Request& req) const {
+        if (fleet.carsOutOfService > 0) {
+            return argminCar(fleet, [&](size_t i) { return cost(fleet, i, req); });
+        }
+        return scoreCars(kernel, fleet.currentFloor.data(), fleet.direction.data(),
+                         fleet.queueSize.data(), fleet.size(), req.fromFloor, params);
+    }
+
+    bool stopsOnlyAddCost() const { return params.queueWeight >= 0; }
+};
+
+// Classic collective control: the car that reaches the caller soonest
+// along its up/down sweep. Meant for StopOrder::Scan.
+struct CollectivePolicy {
+    int cost(const ElevatorFleet& fleet, size_t i, const Request& req) const {
+        return lookDistance(fleet, i, req.fromFloor);
+    }
+
+    int choose(const ElevatorFleet& fleet, const Request& req) const {
+        return argminCar(fleet, [&](size_t i) { return cost(fleet, i, req); });
+    }
+
+    bool stopsOnlyAddCost() const { return true; }
+};
+
+struct EtaPolicy {
+    int cost(const ElevatorFleet& fleet, size_t i, const Request& req) const {
+        return etaTo(fleet, i, req.fromFloor);
+    }
+
+    int choose(const ElevatorFleet& fleet, const Request& req) const {
+        return argminCar(fleet, [&](size_t i) { return cost(fleet, i, req); });
+    }
+
+    bool stopsOnlyAddCost() const { return true; }
+};
+
+/*
+   Destination dispatch: hall calls already carry their destination, so
+   calls are grouped onto cars that stop at both floors anyway. Cost is
+   the rider's ETA plus STOP_TICKS for every new stop times the stops the
+   car already has queued, all of which it delays.
+*/
+struct DestinationPolicy {
+    int cost(const ElevatorFleet& fleet, size_t i, const Request& req) const {
+        int newStops = !fleet.hasStop(i, req.fromFloor) + !fleet.hasStop(i, req.toFloor);
+        return etaTo(fleet, i, req.fromFloor) + STOP_TICKS * newStops * (1 + fleet.queueSize[i]);
+    }
+
+    int choose(const ElevatorFleet& fleet, const Request& req) const {
+        return argminCar(fleet, [&](size_t i) { return cost(fleet, i, req); });
+    }
+
+    // Withdrawing the pickup makes it a new stop again
+    bool stopsOnlyAddCost() const { return false; }
+};
+
+// ================== Parallel loops ==================
+
+// Calls fn(k) for every k in [0, count) on up to `threads` threads (the
+// caller's included). Indices are handed out one at a time, so replicas
+// of uneven length still keep every thread busy.
+template <typename Fn>
+void parallelFor(size_t count, int threads, Fn fn) {
+    atomic<size_t> nextIndex(0);
+    auto worker = [&]() {
+        for (size_t k = nextIndex++; k < count; k = nextIndex++) {
+            fn(k);
+        }
+    };
+
+    size_t workers = min(count, static_cast<size_t>(max(1, threads)));
+    vector<thread> pool;
+    for (size_t t = 1; t < workers; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (thread& t : pool) {
+        t.join();
+    }
+}
+
+// ================== Batch assignment ==================
+
+/*
+   Minimum-cost assignment of a batch of requests to cars, each taking at
+   most one: a rows x cols row-major cost matrix with rows <= cols, solved
+   into rowToCol. Up to HUNGARIAN_MAX_ROWS rows the Hungarian method
+   (shortest augmenting paths, O(rows^2 * cols)) is used; larger, nearly
+   square batches go to an auction with epsilon scaling whose bidding
+   rounds can be split across threads. Both stop once `deadline` passes and return
+   false, so the caller can fall back to greedy assignment. Scratch space
+   is kept between calls.
+*/
+class AssignmentSolver {
+public:
+    typedef chrono::steady_clock::time_point Deadline;
+
+    static const int HUNGARIAN_MAX_ROWS = 128;
+
+private:
+    // Hungarian (1-based columns, column 0 is the virtual root)
+    vector<long long> rowPotential;
+    vector<long long> colPotential;
+    vector<long long> slack;
+    vector<int> colRow;
+    vector<int> colWay;
+    vector<char> colUsed;
+
+    // Auction
+    vector<long long> price;
+    vector<int> objectOwner;
+    vector<int> personObject;
+    vector<int> bidders;
+    vector<int> bidObject;
+    vector<long long> bidPrice;
+    vector<long long> topBid;
+    vector<int> topBidder;
+    vector<int> touched;
+
+    static bool expired(Deadline deadline) {
+        return chrono::steady_clock::now() > deadline;
+    }
+
+public:
+    bool hungarian(const int* cost, int rows, int cols, vector<int>& rowToCol,
+                   Deadline deadline) {
+        const long long INF = numeric_limits<long long>::max() / 4;
+        rowPotential.assign(rows + 1, 0);
+        colPotential.assign(cols + 1, 0);
+        colRow.assign(cols + 1, 0);
+        colWay.assign(cols + 1, 0);
+
+        for (int i = 1; i <= rows; ++i) {
+            if ((i & 7) == 0 && expired(deadline)) {
+                return false;
+            }
+            colRow[0] = i;
+            int j0 = 0;
+            slack.assign(cols + 1, INF);
+            colUsed.assign(cols + 1, 0);
+            do {
+                colUsed[j0] = 1;
+                int i0 = colRow[j0];
+                const int* costRow = cost + static_cast<size_t>(i0 - 1) * cols;
+                long long delta = INF;
+                int j1 = 0;
+                for (int j = 1; j <= cols; ++j) {
+                    if (colUsed[j]) {
+                        continue;
+                    }
+                    long long reduced = costRow[j - 1] - rowPotential[i0] - colPotential[j];
+                    if (reduced < slack[j]) {
+                        slack[j] = reduced;
+                        colWay[j] = j0;
+                    }
+                    if (slack[j] < delta) {
+                        delta = slack[j];
+                        j1 = j;
+                    }
+                }
+                for (int j = 0; j <= cols; ++j) {
+                    if (colUsed[j]) {
+                        rowPotential[colRow[j]] += delta;
+                        colPotential[j] -= delta;
+                    } else {
+                        slack[j] -= delta;
+                    }
+                }
+                j0 = j1;
+            } while (colRow[j0] != 0);
+            do {
+                int j1 = colWay[j0];
+                colRow[j0] = colRow[j1];
+                j0 = j1;
+            } while (j0 != 0);
+        }
+
+        rowToCol.assign(rows, -1);
+        for (int j = 1; j <= cols; ++j) {
+            if (colRow[j] != 0) {
+                rowToCol[colRow[j] - 1] = j - 1;
+            }
+        }
+        return true;
+    }
+
+    /*
+       Padded to a square problem with cols - rows zero-cost dummy rows.
+       Benefits are -cost * (cols + 1), so finishing at epsilon 1 makes the
+       assignment exactly optimal. Rounds with enough work bid Jacobi-style
+       (every unassigned person against the same prices, in parallel);
+       the rest bid Gauss-Seidel-style, one person at a time.
+    */
+    bool auction(const int* cost, int rows, int cols, vector<int>& rowToCol,
+                 Deadline deadline, int threads) {
+        const int n = cols;
+        const long long scale = n + 1;
+        int maxCost = 0;
+        for (size_t k = 0; k < static_cast<size_t>(rows) * cols; ++k) {
+            maxCost = max(maxCost, abs(cost[k]));
+        }
+
+        // Person i's favourite object and the price that keeps it favourite
+        // by epsilon over the runner-up.
+        long long epsilon = 1;
+        auto bestBid = [&](int i, int& object, long long& bid) {
+            const int* line = i < rows ? cost + static_cast<size_t>(i) * cols : nullptr;
+            long long best = numeric_limits<long long>::min();
+            long long second = numeric_limits<long long>::min();
+            object = 0;
+            for (int j = 0; j < n; ++j) {
+                long long value = (line ? -line[j] * scale : 0) - price[j];
+                if (value > best) {
+                    second = best;
+                    best = value;
+                    object = j;
+                } else if (value > second) {
+                    second = value;
+                }
+            }
+            bid = price[object] + (n == 1 ? 0 : best - second) + epsilon;
+        };
+        auto award = [&](int j, int person, long long bid) {
+            if (objectOwner[j] >= 0) {
+                personObject[objectOwner[j]] = -1;
+                bidders.push_back(objectOwner[j]);
+            }
+            objectOwner[j] = person;
+            personObject[person] = j;
+            price[j] = bid;
+        };
+
+        price.assign(n, 0);
+        topBidder.assign(n, -1);
+        topBid.resize(n);
+        epsilon = max<long long>(1, maxCost * scale / 4);
+        while (true) {
+            objectOwner.assign(n, -1);
+            personObject.assign(n, -1);
+            bidders.resize(n);
+            for (int i = 0; i < n; ++i) {
+                bidders[i] = n - 1 - i;
+            }
+
+            while (!bidders.empty()) {
+                if (expired(deadline)) {
+                    return false;
+                }
+                const size_t count = bidders.size();
+                if (threads <= 1 || count * n < (1u << 20)) {
+                    // Gauss-Seidel: a batch of single bids on live prices
+                    for (size_t k = 0; k < count && !bidders.empty(); ++k) {
+                        int i = bidders.back();
+                        bidders.pop_back();
+                        int j;
+                        long long bid;
+                        bestBid(i, j, bid);
+                        award(j, i, bid);
+                    }
+                    continue;
+                }
+
+                // Jacobi: bids only read prices, so persons bid in parallel
+                bidObject.resize(count);
+                bidPrice.resize(count);
+                size_t chunks = static_cast<size_t>(threads);
+                parallelFor(chunks, threads, [&](size_t c) {
+                    for (size_t k = count * c / chunks; k < count * (c + 1) / chunks; ++k) {
+                        bestBid(bidders[k], bidObject[k], bidPrice[k]);
+                    }
+                });
+
+                // Each object goes to its highest bidder (earliest on ties)
+                touched.clear();
+                for (size_t k = 0; k < count; ++k) {
+                    int j = bidObject[k];
+                    if (topBidder[j] < 0) {
+                        touched.push_back(j);
+                    }
+                    if (topBidder[j] < 0 || bidPrice[k] > topBid[j]) {
+                        topBid[j] = bidPrice[k];
+                        topBidder[j] = bidders[k];
+                    }
+                }
+                size_t kept = 0;
+                for (size_t k = 0; k < count; ++k) {
+                    if (topBidder[bidObject[k]] != bidders[k]) {
+                        bidders[kept++] = bidders[k];
+                    }
+                }
+                bidders.resize(kept);
+                for (int j : touched) {
+                    award(j, topBidder[j], topBid[j]);
+                    topBidder[j] = -1;
+                }
+            }
+
+            if (epsilon == 1) {
+                break;
+            }
+            epsilon = max<long long>(1, epsilon / 5);
+        }
+
+        rowToCol.assign(personObject.begin(), personObject.begin() + rows);
+        return true;
+    }
+
+    // Returns whether the assignment finished; `usedAuction` reports which
+    // method ran. The auction only gets large, nearly square problems:
+    // identical dummy rows bid against each other in tiny increments.
+    bool solve(const int* cost, int rows, int cols, vector<int>& rowToCol,
+               Deadline deadline, int threads, bool& usedAuction) {
+        usedAuction = rows > HUNGARIAN_MAX_ROWS && cols - rows <= rows / 8;
+        return usedAuction ? auction(cost, rows, cols, rowToCol, deadline, threads)
+                           : hungarian(cost, rows, cols, rowToCol, deadline);
+    }
+};
+
+// ================== Snapshots ==================
+
+/*
+   Checkpoint file: a header, a table of sections, then each section's
+   items as raw arrays in host byte order, aligned to 8 bytes. The header
+   records the writer's byte order and the reader refuses a file whose
+   tag does not match its own, so snapshots move only between machines
+   of the same endianness.
+
+       SnapshotHeader   "ESNP", version, section count, byte-order tag
+       SnapshotEntry[]  id, item size, file offset, item count
+       data
+
+   Every array is stored exactly as it is kept in memory, so a reader maps
+   the file and hands out pointers into it; restoring is one copy per
+   array, with no per-item parsing. Readers skip section ids they do not
+   know, and a changed item layout must come with a new VERSION.
+*/
+enum class SnapshotSection : uint32_t {
+    System = 1,         // SnapshotSystemState
+    // ElevatorFleet, one item per car unless noted
+    CurrentFloor,
+    Direction,
+    DoorOpen,
+    QueueHead,
+    QueueSize,
+    StopsServed,
+    FloorsTraveled,
+    Changed,
+    RouteLegs,
+    TargetCounts,       // FIFO queue length per car ...
+    Targets,            // ... and the queues, front first, back to back
+    StopBits,           // SCAN, stopWords per car
+    StopCounts,
+    TopStop,
+    BottomStop,
+    Pending,            // pendingRequests
+    // TripTracker
+    InFlight,
+    WaitingCounts,
+    Waiting,
+    RidingCounts,
+    Riding,
+    WaitHistogram,
+    WaitHistogramStats,
+    RideHistogram,
+    RideHistogramStats,
+    OutOfService        // ElevatorFleet, per car
+};
+
+struct SnapshotHeader {
+    char magic[4];          // "ESNP"
+    uint32_t version;
+    uint32_t sections;
+    uint32_t byteOrder;     // BYTE_ORDER_TAG as written by this machine
+
+    static const uint32_t VERSION = 2;      // 2: riders record their reassignments
+    static const uint32_t BYTE_ORDER_TAG = 0x01020304;
+};
+
+struct SnapshotEntry {
+    uint32_t id;
+    uint32_t itemSize;
+    uint64_t offset;        // from the start of the file
+    uint64_t count;
+};
+
+static_assert(sizeof(SnapshotHeader) == 16, "SnapshotHeader must stay 16 bytes");
+static_assert(sizeof(SnapshotEntry) == 24, "SnapshotEntry must stay 24 bytes");
+
+class SnapshotWriter {
+private:
+    vector<SnapshotEntry> table;
+    vector<char> data;      // section payloads; offsets relative to here
+
+public:
+    template <typename T>
+    void add(SnapshotSection id, const T* items, size_t count) {
+        static_assert(is_trivially_copyable<T>::value, "snapshot items are raw bytes");
+        data.resize((data.size() + 7) & ~size_t(7));
+        table.push_back(SnapshotEntry{static_cast<uint32_t>(id), sizeof(T),
+                                      data.size(), count});
+        const char* bytes = reinterpret_cast<const char*>(items);
+        data.insert(data.end(), bytes, bytes + count * sizeof(T));
+    }
+
+    template <typename T>
+    void add(SnapshotSection id, const vector<T>& items) {
+        add(id, items.data(), items.size());
+    }
+
+    // Returns the file size, or 0 if the file could not be written.
+    size_t write(const string& path) const {
+        SnapshotHeader h = {{'E', 'S', 'N', 'P'}, SnapshotHeader::VERSION,
+                            static_cast<uint32_t>(table.size()), SnapshotHeader::BYTE_ORDER_TAG};
+        const size_t dataStart = (sizeof(h) + table.size() * sizeof(SnapshotEntry) + 7) &
+                                 ~size_t(7);
+        vector<SnapshotEntry> placed(table);
+        for (SnapshotEntry& e : placed) {
+            e.offset += dataStart;
+        }
+
+        ofstream out(path, ios::binary);
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(placed.data()),
+                  static_cast<streamsize>(placed.size() * sizeof(SnapshotEntry)));
+        const char padding[8] = {};
+        out.write(padding, static_cast<streamsize>(dataStart - sizeof(h) -
+                                                   placed.size() * sizeof(SnapshotEntry)));
+        out.write(data.data(), static_cast<streamsize>(data.size()));
+        return out ? dataStart + data.size() : 0;
+    }
+};
+
+// Maps a checkpoint file (reads it whole where mmap is unavailable) and
+// hands out typed pointers to its sections after checking their bounds.
+class SnapshotReader {
+private:
+    const char* bytes;
+    size_t length;
+    bool mapped;
+    vector<char> copy;
+    const SnapshotEntry* table;
+    uint32_t sections;
+
+public:
+    SnapshotReader()
+        : bytes(nullptr), length(0), mapped(false), table(nullptr), sections(0) {}
+
+    ~SnapshotReader() {
+#ifdef ELEVATOR_HAVE_MMAP
+        if (mapped) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+#endif
+    }
+
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    bool open(const string& path, string& error) {
+#ifdef ELEVATOR_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* m = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                           MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                bytes = static_cast<const char*>(m);
+                length = static_cast<size_t>(st.st_size);
+                mapped = true;
+            }
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+        if (!bytes) {
+            ifstream in(path, ios::binary);
+            copy.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+            if (!in.is_open() || copy.empty()) {
+                error = "cannot read " + path;
+                return false;
+            }
+            bytes = copy.data();
+            length = copy.size();
+        }
+
+        SnapshotHeader h;
+        if (length < sizeof(h)) {
+            error = "not a snapshot: " + path;
+            return false;
+        }
+        memcpy(&h, bytes, sizeof(h));
+        if (memcmp(h.magic, "ESNP", 4) != 0) {
+            error = "not a snapshot: " + path;
+            return false;
+        }
+        if (h.byteOrder != SnapshotHeader::BYTE_ORDER_TAG) {
+            error = "snapshot was written with a different byte order";
+            return false;
+        }
+        if (h.version != SnapshotHeader::VERSION) {
+            error = "unsupported snapshot version " + to_string(h.version);
+            return false;
+        }
+        if ((length - sizeof(h)) / sizeof(SnapshotEntry) < h.sections) {
+            error = "truncated snapshot: " + path;
+            return false;
+        }
+        table = reinterpret_cast<const SnapshotEntry*>(bytes + sizeof(h));
+        sections = h.sections;
+        for (uint32_t k = 0; k < sections; ++k) {
+            const SnapshotEntry& e = table[k];
+            if (e.offset % 8 != 0 || e.offset > length ||
+                (e.itemSize > 0 && e.count > (length - e.offset) / e.itemSize)) {
+                error = "corrupt snapshot section table: " + path;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Section id as an array of T, or false if it is absent or its items
+    // are not T-sized.
+    template <typename T>
+    bool get(SnapshotSection id, const T*& items, size_t& count) const {
+        for (uint32_t k = 0; k < sections; ++k) {
+            if (table[k].id == static_cast<uint32_t>(id)) {
+                if (table[k].itemSize != sizeof(T)) {
+                    return false;
+                }
+                items = reinterpret_cast<const T*>(bytes + table[k].offset);
+                count = static_cast<size_t>(table[k].count);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Copies a section into out; with `expected` set, only if it has that
+    // many items.
+    template <typename T>
+    bool read(SnapshotSection id, vector<T>& out, size_t expected = SIZE_MAX) const {
+        const T* items = nullptr;
+        size_t count = 0;
+        if (!get(id, items, count) || (expected != SIZE_MAX && count != expected)) {
+            return false;
+        }
+        out.assign(items, items + count);
+        return true;
+    }
+
+    template <typename T>
+    bool readOne(SnapshotSection id, T& out) const {
+        const T* items = nullptr;
+        size_t count = 0;
+        if (!get(id, items, count) || count != 1) {
+            return false;
+        }
+        memcpy(&out, items, sizeof(T));
+        return true;
+    }
+};
+
+// ================== Trip statistics ==================
+
+/*
+   Log-linear histogram of non-negative integer samples: values below 64
+   are counted exactly, larger ones in 32 sub-buckets per power of two
+   (at most ~3% relative error). Memory is fixed, so it can stay on for
+   runs of any length; the mean and maximum are exact. The buckets are
+   allocated with the first sample and shared copy-on-write, so copying
+   or clearing a histogram (e.g. at ElevatorSystem::fork) is free.
+*/
+class LatencyHistogram {
+private:
+    static const int SUB_BUCKETS = 32;
+    static const int BUCKETS = 64 + 58 * SUB_BUCKETS;
+
+    SharedVector<uint64_t> counts;  // BUCKETS entries, or none before any sample
+    uint64_t total;
+    double sum;
+    uint64_t maxValue;
+
+    static int indexOf(uint64_t v) {
+        if (v < 64) {
+            return static_cast<int>(v);
+        }
+        int shift = 63 - __builtin_clzll(v) - 5;
+        return shift * SUB_BUCKETS + static_cast<int>(v >> shift);
+    }
+
+    static uint64_t lowestValueAt(int index) {
+        if (index < 64) {
+            return static_cast<uint64_t>(index);
+        }
+        int shift = index / SUB_BUCKETS - 1;
+        return static_cast<uint64_t>(index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    }
+
+public:
+    LatencyHistogram() : total(0), sum(0), maxValue(0) {}
+
+    void record(uint64_t value, uint64_t count = 1) {
+        vector<uint64_t>& buckets = counts.edit();
+        if (buckets.empty()) {
+            buckets.assign(BUCKETS, 0);
+        }
+        buckets[indexOf(value)] += count;
+        total += count;
+        sum += static_cast<double>(value) * count;
+        maxValue = max(maxValue, value);
+    }
+
+    struct Stats {
+        uint64_t total;
+        double sum;
+        uint64_t maxValue;
+    };
+
+    void save(SnapshotWriter& out, SnapshotSection countsId, SnapshotSection statsId) const {
+        Stats st = {total, sum, maxValue};
+        if (counts.empty()) {
+            out.add(countsId, vector<uint64_t>(BUCKETS, 0));
+        } else {
+            out.add(countsId, counts.get());
+        }
+        out.add(statsId, &st, 1);
+    }
+
+    bool restore(const SnapshotReader& in, SnapshotSection countsId, SnapshotSection statsId) {
+        Stats st;
+        vector<uint64_t> buckets;
+        if (!in.read(countsId, buckets, BUCKETS) || !in.readOne(statsId, st)) {
+            return false;
+        }
+        counts = SharedVector<uint64_t>(move(buckets));
+        total = st.total;
+        sum = st.sum;
+        maxValue = st.maxValue;
+        return true;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        if (counts.empty()) {
+            counts = other.counts;
+        } else if (!other.counts.empty()) {
+            vector<uint64_t>& buckets = counts.edit();
+            for (int k = 0; k < BUCKETS; ++k) {
+                buckets[k] += other.counts[k];
+            }
+        }
+        total += other.total;
+        sum += other.sum;
+        maxValue = max(maxValue, other.maxValue);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t maxSample() const { return maxValue; }
+    double mean() const { return total ? sum / total : 0.0; }
+
+    // Smallest recorded bucket value covering fraction p (0..1) of samples
+    uint64_t percentile(double p) const {
+        if (total == 0 || counts.empty()) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p * total);
+        rank = rank < 1 ? 1 : (rank > total ? total : rank);
+        uint64_t seen = 0;
+        for (int k = 0; k < BUCKETS; ++k) {
+            seen += counts[k];
+            if (seen >= rank) {
+                return std::min(lowestValueAt(k), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+    void print(const char* label, const char* unit) const {
+        streamsize oldPrecision = cout.precision();
+        cout << label << " (" << unit << "): mean " << fixed << setprecision(2) << mean()
+             << ", p50 " << percentile(0.50) << ", p90 " << percentile(0.90)
+             << ", p99 " << percentile(0.99) << ", max " << maxValue
+             << " (" << total << " samples)\n";
+        cout.unsetf(ios::fixed);
+        cout.precision(oldPrecision);
+    }
+};
+
+/*
+   Follows every assigned request from its car's pickup to its drop-off:
+   wait = pickup - timeRequested, ride = drop-off - pickup. A rider is
+   picked up the first time its car opens the door at fromFloor and
+   dropped the first time it then opens at toFloor. Completed trips only
+   add to the histograms, weighted by the request's passenger count.
+
+   In-flight riders live in one pool of slots shared by the fleet; each
+   car threads its waiting and on-board riders through the pool as two
+   linked lists, and freed slots go on a free list. The system reserves a
+   slot for every call it admits (reserve()), so assigning, boarding,
+   moving and delivering riders inside step() never allocates. The pool
+   is copy-on-write: a fork shares it with its parent until either side
+   changes a rider.
+
+   A hash table keyed by (car, floor) counts the riders waiting there and
+   those on board getting off there, so whether a car must stop at a floor
+   for anyone is O(1). It has at most one entry per rider and is kept at
+   least twice the pool's size, so it grows with the pool and never inside
+   step(). It is copy-on-write like the pool.
+*/
+class TripTracker {
+private:
+    struct Rider {
+        int fromFloor;
+        int toFloor;
+        int timeRequested;
+        int timePickedUp;
+        int passengers;
+        int moves;          // times reassigned to another car
+        int movedFrom;      // car it was last moved away from, -1 if none
+    };
+
+    // Riders of one car at one floor; key EMPTY_KEY marks a free entry
+    struct FloorCount {
+        uint64_t key;       // car << 32 | floor
+        int32_t waiting;    // waiting for pickup there
+        int32_t riding;     // on board, getting off there
+    };
+
+    static const uint64_t EMPTY_KEY = ~uint64_t(0);
+
+    struct Slot {
+        Rider rider;
+        int32_t prev;
+        int32_t next;       // also links the free list
+    };
+
+    // A car's riders in assignment (or boarding) order
+    struct RiderList {
+        int32_t head = -1;
+        int32_t tail = -1;
+        uint32_t count = 0;
+    };
+
+    SharedVector<Slot> slots;
+    int32_t freeSlot;                   // first free slot, -1 when none
+    vector<RiderList> waiting;          // per car, assigned but not picked up
+    vector<RiderList> riding;           // per car, on board
+    SharedVector<FloorCount> floorCounts;   // open addressing, power-of-two size
+    LatencyHistogram waitTimes;
+    LatencyHistogram rideTimes;
+    long long inFlight;                 // occupied slots
+
+public:
+    TripTracker() : freeSlot(-1), inFlight(0) {}
+
+    void addCar() {
+        waiting.emplace_back();
+        riding.emplace_back();
+    }
+
+    // Makes room for `calls` more riders, so that many assignments
+    // cannot grow the pool.
+    void reserve(size_t calls) {
+        const size_t have = slots.size();
+        const size_t needed = static_cast<size_t>(inFlight) + calls;
+        if (needed <= have) {
+            return;
+        }
+        const size_t grown = max(needed, max<size_t>(2 * have, 64));
+        vector<Slot>& pool = slots.edit();
+        pool.resize(grown);
+        for (size_t s = grown; s-- > have; ) {
+            pool[s].next = freeSlot;
+            freeSlot = static_cast<int32_t>(s);
+        }
+        size_t tableSize = max<size_t>(floorCounts.size(), 128);
+        while (tableSize < 2 * grown) {
+            tableSize *= 2;
+        }
+        if (tableSize != floorCounts.size()) {
+            rehash(tableSize);
+        }
+    }
+
+    // `boardNow` when the car already stands at fromFloor with its door open
+    void onAssigned(int car, const Request& req, int now, bool boardNow) {
+        if (freeSlot < 0) {
+            reserve(1);
+        }
+        const int32_t s = freeSlot;
+        vector<Slot>& pool = slots.edit();
+        freeSlot = pool[s].next;
+        pool[s].rider = {req.fromFloor, req.toFloor, req.timeRequested, now, req.passengers,
+                         0, -1};
+        ++inFlight;
+        if (boardNow) {
+            waitTimes.record(now - req.timeRequested, req.passengers);
+            append(riding[car], s);
+            adjust(car, req.toFloor, 0, 1);
+        } else {
+            append(waiting[car], s);
+            adjust(car, req.fromFloor, 1, 0);
+        }
+    }
+
+    // boarded(toFloor) is called for every rider picked up here.
+    template <typename Boarded>
+    void onDoorOpen(int car, int floor, int now, Boarded boarded) {
+        // The lists are only walked, and the pool only edited (and so
+        // unshared), when someone gets off or on here.
+        const FloorCount* here = find(car, floor);
+        if (here == nullptr) {
+            return;
+        }
+        const bool leaving = here->riding > 0;
+        const bool boarding = here->waiting > 0;
+        if (leaving) {
+            for (int32_t s = riding[car].head; s >= 0; ) {
+                const int32_t next = slots[s].next;
+                if (slots[s].rider.toFloor == floor) {
+                    const Rider& r = slots[s].rider;
+                    rideTimes.record(now - r.timePickedUp, r.passengers);
+                    unlink(riding[car], s);
+                    release(s);
+                    adjust(car, floor, 0, -1);
+                }
+                s = next;
+            }
+        }
+
+        for (int32_t s = boarding ? waiting[car].head : -1; s >= 0; ) {
+            const int32_t next = slots[s].next;
+            if (slots[s].rider.fromFloor == floor) {
+                unlink(waiting[car], s);
+                Rider& r = slots.edit()[s].rider;
+                r.timePickedUp = now;
+                waitTimes.record(now - r.timeRequested, r.passengers);
+                append(riding[car], s);
+                adjust(car, floor, -1, 0);
+                adjust(car, r.toFloor, 0, 1);
+                boarded(r.toFloor);
+            }
+            s = next;
+        }
+    }
+
+    // Calls assigned to car but not picked up yet, walked with
+    // firstWaiting() / nextWaiting(); -1 ends the walk. A handle stays
+    // valid until its call is moved away or dropped.
+    size_t waitingCount(int car) const { return waiting[car].count; }
+    int firstWaiting(int car) const { return waiting[car].head; }
+    int nextWaiting(int call) const { return slots[call].next; }
+
+    Request waitingCall(int call) const {
+        const Rider& r = slots[call].rider;
+        return Request(r.fromFloor, r.toFloor, r.timeRequested, r.passengers);
+    }
+
+    // How often a waiting call was moved, and the car it last left (-1).
+    int timesMoved(int call) const { return slots[call].rider.moves; }
+    int movedFrom(int call) const { return slots[call].rider.movedFrom; }
+
+    // Whether car must stop at waiting call's floor for someone else too.
+    bool sharesStop(int car, int call) const {
+        const FloorCount* here = find(car, slots[call].rider.fromFloor);
+        return here->waiting > 1 || here->riding > 0;
+    }
+
+    // Whether someone on board car gets off at floor.
+    bool ridingTo(int car, int floor) const {
+        const FloorCount* here = find(car, floor);
+        return here != nullptr && here->riding > 0;
+    }
+
+    // Hands waiting call of car over to toCar (see onAssigned).
+    void moveWaiting(int car, int call, int toCar, int now, bool boardNow) {
+        unlink(waiting[car], call);
+        Rider& r = slots.edit()[call].rider;
+        ++r.moves;
+        r.movedFrom = car;
+        adjust(car, r.fromFloor, -1, 0);
+        if (boardNow) {
+            r.timePickedUp = now;
+            waitTimes.record(now - r.timeRequested, r.passengers);
+            append(riding[toCar], call);
+            adjust(toCar, r.toFloor, 0, 1);
+        } else {
+            append(waiting[toCar], call);
+            adjust(toCar, r.fromFloor, 1, 0);
+        }
+    }
+
+    // Withdraws waiting call of car; it is no longer in flight.
+    Request dropWaiting(int car, int call) {
+        Request req = waitingCall(call);
+        unlink(waiting[car], call);
+        adjust(car, req.fromFloor, -1, 0);
+        release(call);
+        return req;
+    }
+
+    // Empties the histograms; riders in flight are kept.
+    void clearStatistics() {
+        waitTimes = LatencyHistogram();
+        rideTimes = LatencyHistogram();
+    }
+
+    const LatencyHistogram& getWaitTimes() const { return waitTimes; }
+    const LatencyHistogram& getRideTimes() const { return rideTimes; }
+    long long getInFlight() const { return inFlight; }
+
+    void save(SnapshotWriter& out) const {
+        saveRiders(out, waiting, SnapshotSection::WaitingCounts, SnapshotSection::Waiting);
+        saveRiders(out, riding, SnapshotSection::RidingCounts, SnapshotSection::Riding);
+        waitTimes.save(out, SnapshotSection::WaitHistogram, SnapshotSection::WaitHistogramStats);
+        rideTimes.save(out, SnapshotSection::RideHistogram, SnapshotSection::RideHistogramStats);
+        int64_t flying = inFlight;
+        out.add(SnapshotSection::InFlight, &flying, 1);
+    }
+
+    // The tracker must already have one slot per car of the snapshot.
+    // Riders off the building's `floors` are rejected.
+    bool restore(const SnapshotReader& in, int floors) {
+        slots = SharedVector<Slot>();
+        floorCounts = SharedVector<FloorCount>();
+        freeSlot = -1;
+        inFlight = 0;
+        fill(waiting.begin(), waiting.end(), RiderList());
+        fill(riding.begin(), riding.end(), RiderList());
+        int64_t flying = 0;
+        if (!restoreRiders(in, waiting, SnapshotSection::WaitingCounts, SnapshotSection::Waiting,
+                           floors) ||
+            !restoreRiders(in, riding, SnapshotSection::RidingCounts, SnapshotSection::Riding,
+                           floors) ||
+            !waitTimes.restore(in, SnapshotSection::WaitHistogram,
+                               SnapshotSection::WaitHistogramStats) ||
+            !rideTimes.restore(in, SnapshotSection::RideHistogram,
+                               SnapshotSection::RideHistogramStats) ||
+            !in.readOne(SnapshotSection::InFlight, flying)) {
+            return false;
+        }
+        if (!floorCounts.empty()) {
+            rehash(floorCounts.size());     // count the restored riders
+        }
+        return flying == inFlight;
+    }
+
+private:
+    void append(RiderList& list, int32_t s) {
+        vector<Slot>& pool = slots.edit();
+        pool[s].prev = list.tail;
+        pool[s].next = -1;
+        if (list.tail >= 0) {
+            pool[list.tail].next = s;
+        } else {
+            list.head = s;
+        }
+        list.tail = s;
+        ++list.count;
+    }
+
+    void unlink(RiderList& list, int32_t s) {
+        vector<Slot>& pool = slots.edit();
+        const int32_t prev = pool[s].prev;
+        const int32_t next = pool[s].next;
+        if (prev >= 0) {
+            pool[prev].next = next;
+        } else {
+            list.head = next;
+        }
+        if (next >= 0) {
+            pool[next].prev = prev;
+        } else {
+            list.tail = prev;
+        }
+        --list.count;
+    }
+
+    void release(int32_t s) {
+        slots.edit()[s].next = freeSlot;
+        freeSlot = s;
+        --inFlight;
+    }
+
+    static uint64_t floorKey(int car, int floor) {
+        return static_cast<uint64_t>(car) << 32 | static_cast<uint32_t>(floor);
+    }
+
+    // Entry of floorCounts where key is, or the free one it would go in
+    size_t probe(uint64_t key) const {
+        const size_t mask = floorCounts.size() - 1;
+        uint64_t h = key * 0x9E3779B97F4A7C15ull;
+        size_t e = static_cast<size_t>(h ^ (h >> 32)) & mask;
+        while (floorCounts[e].key != key && floorCounts[e].key != EMPTY_KEY) {
+            e = (e + 1) & mask;
+        }
+        return e;
+    }
+
+    // The counts of car at floor, or null when nobody is waiting or riding there
+    const FloorCount* find(int car, int floor) const {
+        if (floorCounts.empty()) {
+            return nullptr;
+        }
+        const FloorCount& entry = floorCounts[probe(floorKey(car, floor))];
+        return entry.key == EMPTY_KEY ? nullptr : &entry;
+    }
+
+    // Adds to the counts of car at floor, dropping the entry once both are 0
+    void adjust(int car, int floor, int waitingBy, int ridingBy) {
+        const uint64_t key = floorKey(car, floor);
+        size_t e = probe(key);
+        vector<FloorCount>& table = floorCounts.edit();
+        if (table[e].key == EMPTY_KEY) {
+            table[e] = {key, 0, 0};
+        }
+        table[e].waiting += waitingBy;
+        table[e].riding += ridingBy;
+        if (table[e].waiting != 0 || table[e].riding != 0) {
+            return;
+        }
+        // Linear probing: pull later entries of the cluster back into the
+        // hole unless their home slot lies cyclically in (hole, entry]
+        const size_t mask = table.size() - 1;
+        for (size_t next = (e + 1) & mask; table[next].key != EMPTY_KEY;
+             next = (next + 1) & mask) {
+            uint64_t h = table[next].key * 0x9E3779B97F4A7C15ull;
+            const size_t home = static_cast<size_t>(h ^ (h >> 32)) & mask;
+            if (((next - home) & mask) >= ((next - e) & mask)) {
+                table[e] = table[next];
+                e = next;
+            }
+        }
+        table[e].key = EMPTY_KEY;
+    }
+
+    // Rebuilds floorCounts with `size` entries from the riders in flight
+    void rehash(size_t size) {
+        floorCounts = SharedVector<FloorCount>(vector<FloorCount>(size, FloorCount{EMPTY_KEY, 0, 0}));
+        for (size_t c = 0; c < waiting.size(); ++c) {
+            const int car = static_cast<int>(c);
+            for (int32_t s = waiting[c].head; s >= 0; s = slots[s].next) {
+                adjust(car, slots[s].rider.fromFloor, 1, 0);
+            }
+            for (int32_t s = riding[c].head; s >= 0; s = slots[s].next) {
+                adjust(car, slots[s].rider.toFloor, 0, 1);
+            }
+        }
+    }
+
+    void saveRiders(SnapshotWriter& out, const vector<RiderList>& perCar,
+                    SnapshotSection countsId, SnapshotSection ridersId) const {
+        vector<uint32_t> counts;
+        vector<Rider> all;
+        for (const RiderList& list : perCar) {
+            counts.push_back(list.count);
+            for (int32_t s = list.head; s >= 0; s = slots[s].next) {
+                all.push_back(slots[s].rider);
+            }
+        }
+        out.add(countsId, counts);
+        out.add(ridersId, all);
+    }
+
+    // Appends the snapshot's riders to the pool, one list per car
+    bool restoreRiders(const SnapshotReader& in, vector<RiderList>& perCar,
+                       SnapshotSection countsId, SnapshotSection ridersId, int floors) {
+        const uint32_t* counts = nullptr;
+        const Rider* riders = nullptr;
+        size_t cars = 0;
+        size_t total = 0;
+        if (!in.get(countsId, counts, cars) || cars != perCar.size() ||
+            !in.get(ridersId, riders, total)) {
+            return false;
+        }
+        reserve(total);
+        size_t used = 0;
+        for (size_t c = 0; c < cars; ++c) {
+            perCar[c] = RiderList();
+            if (counts[c] > total - used) {
+                return false;
+            }
+            for (uint32_t k = 0; k < counts[c]; ++k) {
+                const Rider& r = riders[used];
+                if (r.fromFloor < 0 || r.fromFloor >= floors || r.toFloor < 0 ||
+                    r.toFloor >= floors || r.passengers < 1 || r.moves < 0 ||
+                    r.movedFrom < -1 || r.movedFrom >= static_cast<int>(cars)) {
+                    return false;
+                }
+                const int32_t s = freeSlot;
+                vector<Slot>& pool = slots.edit();
+                freeSlot = pool[s].next;
+                pool[s].rider = riders[used++];
+                ++inFlight;
+                append(perCar[c], s);
+            }
+        }
+        return used == total;
+    }
+};
+
+// ================== Tick profiling ==================
+
+/*
+   Built with -DELEVATOR_PROFILE (make PROFILE=1), ElevatorSystem times the
+   phases of every tick with PROFILE_SCOPE and printSummary() adds one
+   latency histogram per phase. A probe is two reads of the TSC (rdtsc)
+   or, off x86, of steady_clock, plus one histogram update; raw clock
+   ticks are only converted to ns for the report. Without the flag
+   PROFILE_SCOPE expands to nothing and no profiler state exists.
+*/
+#ifdef ELEVATOR_PROFILE
+
+enum class TickPhase {
+    Tick,           // all of step()
+    Assign,         // assignRequests()
+    Reassign,       // reassignCalls() passes that ran
+    Cars,           // step(): the per-car step / door loop
+    Log,            // step(): status records
+    Events,         // event engine: door events and straight runs
+    Count
+};
+
+inline uint64_t profileClock() {
+#ifdef ELEVATOR_HAVE_RDTSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// profileClock() ticks per nanosecond, measured once against steady_clock.
+inline double profileTicksPerNs() {
+    static const double ticksPerNs = []() {
+        auto start = chrono::steady_clock::now();
+        uint64_t ticks = profileClock();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        ticks = profileClock() - ticks;
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        return ticks / ns;
+    }();
+    return ticksPerNs;
+}
+
+enum class HwCounter {
+    Cycles,
+    Instructions,
+    CacheRefs,
+    CacheMisses,
+    Branches,
+    BranchMisses,
+    Count
+};
+
+const int HW_COUNTERS = static_cast<int>(HwCounter::Count);
+
+/*
+   User-space hardware counters of the calling thread, opened as one
+   perf_event group: the kernel schedules them together, so ratios stay
+   meaningful under multiplexing, and one read() returns them all. Events
+   the CPU or hypervisor does not offer are left out; if not even the
+   cycle counter opens (perf_event_paranoid, containers, other platforms)
+   open() says why and nothing is counted.
+*/
+class PerfGroup {
+private:
+    int fds[HW_COUNTERS];
+    int slot[HW_COUNTERS];       // index in the group read, -1 if not open
+    int opened;
+
+public:
+    PerfGroup() : opened(0) {
+        for (int c = 0; c < HW_COUNTERS; ++c) {
+            fds[c] = -1;
+            slot[c] = -1;
+        }
+    }
+
+    ~PerfGroup() {
+#ifdef ELEVATOR_HAVE_PERF
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    PerfGroup(const PerfGroup&) = delete;
+    PerfGroup& operator=(const PerfGroup&) = delete;
+
+    // Returns an empty string on success, otherwise the reason.
+    string open() {
+#ifdef ELEVATOR_HAVE_PERF
+        static const pair<uint32_t, uint64_t> events[HW_COUNTERS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        for (int c = 0; c < HW_COUNTERS; ++c) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[c].first;
+            attr.config = events[c].second;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = fds[0] < 0 ? 1 : 0;     // the leader starts the group
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            long fd = syscall(__NR_perf_event_open, &attr, 0, -1, fds[0], 0);
+            if (fd < 0) {
+                if (c == 0) {
+                    return string("perf_event_open: ") + strerror(errno);
+                }
+                continue;
+            }
+            fds[c] = static_cast<int>(fd);
+            slot[c] = opened++;
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return "";
+#else
+        return "perf_event_open is Linux-only";
+#endif
+    }
+
+    bool isOpen() const { return opened > 0; }
+    bool has(HwCounter c) const { return slot[static_cast<int>(c)] >= 0; }
+
+    // Current counts into values[HW_COUNTERS] (missing events stay 0).
+    void read(uint64_t* values) const {
+        uint64_t buf[1 + HW_COUNTERS] = {};
+#ifdef ELEVATOR_HAVE_PERF
+        if (::read(fds[0], buf, sizeof(buf)) <= 0) {
+            buf[0] = 0;
+        }
+#endif
+        for (int c = 0; c < HW_COUNTERS; ++c) {
+            values[c] = slot[c] >= 0 && static_cast<uint64_t>(slot[c]) < buf[0]
+                            ? buf[1 + slot[c]] : 0;
+        }
+    }
+};
+
+class TickProfiler {
+private:
+    LatencyHistogram phases[static_cast<int>(TickPhase::Count)];   // clock ticks
+
+    // Hardware counters (enableHardwareCounters), summed per phase
+    PerfGroup perf;
+    string perfStatus;          // why counters are off, if they were asked for
+    uint64_t counts[static_cast<int>(TickPhase::Count)][HW_COUNTERS] = {};
+
+public:
+    void record(TickPhase phase, uint64_t ticks) {
+        phases[static_cast<int>(phase)].record(ticks);
+    }
+
+    bool countsHardware() const { return perf.isOpen(); }
+    void readCounters(uint64_t* values) const { perf.read(values); }
+
+    void addCounters(TickPhase phase, const uint64_t* begin, const uint64_t* end) {
+        uint64_t* sum = counts[static_cast<int>(phase)];
+        for (int c = 0; c < HW_COUNTERS; ++c) {
+            sum[c] += end[c] - begin[c];
+        }
+    }
+
+    // Counts for the thread calling this, which should be the one that
+    // steps the system. Returns false, keeping the reason for print().
+    bool enableHardwareCounters() {
+        if (perf.isOpen()) {
+            return true;
+        }
+        perfStatus = perf.open();
+        return perfStatus.empty();
+    }
+
+    void print() const;
+    void printCounters() const;
+};
+
+// Timer probe; with hardware counters on, the counters are read outside
+// the timed interval (a read() syscall each) and added to the phase too.
+class ScopedTimer {
+private:
+    TickProfiler& profiler;
+    TickPhase phase;
+    bool counting;
+    uint64_t begin[HW_COUNTERS];
+    uint64_t start;
+
+public:
+    ScopedTimer(TickProfiler& p, TickPhase ph)
+        : profiler(p), phase(ph), counting(p.countsHardware())
+    {
+        if (counting) {
+            profiler.readCounters(begin);
+        }
+        start = profileClock();
+    }
+
+    ~ScopedTimer() {
+        profiler.record(phase, profileClock() - start);
+        if (counting) {
+            uint64_t end[HW_COUNTERS];
+            profiler.readCounters(end);
+            profiler.addCounters(phase, begin, end);
+        }
+    }
+};
+
+static const char* TICK_PHASE_NAMES[] = {"tick", "assign", "reassign", "cars", "log", "events"};
+
+void TickProfiler::print() const {
+    const char* const* names = TICK_PHASE_NAMES;
+    const double ticksPerNs = profileTicksPerNs();
+
+    // What a probe itself costs, timed on a scratch profiler
+    const int probes = 1 << 20;
+    TickProfiler scratch;
+    uint64_t start = profileClock();
+    for (int k = 0; k < probes; ++k) {
+        ScopedTimer t(scratch, TickPhase::Tick);
+    }
+    double probeNs = (profileClock() - start) / ticksPerNs / probes;
+
+    streamsize oldPrecision = cout.precision();
+    cout << fixed << setprecision(1);
+    cout << "Tick profile (ns per call; clock " << ticksPerNs << " ticks/ns, "
+         << probeNs << " ns per probe):\n";
+    for (int k = 0; k < static_cast<int>(TickPhase::Count); ++k) {
+        const LatencyHistogram& h = phases[k];
+        if (h.count() == 0) {
+            continue;
+        }
+        cout << "  " << left << setw(9) << names[k] << right
+             << "mean " << h.mean() / ticksPerNs
+             << ", p50 " << h.percentile(0.50) / ticksPerNs
+             << ", p99 " << h.percentile(0.99) / ticksPerNs
+             << ", max " << h.maxSample() / ticksPerNs
+             << ", total " << h.mean() * h.count() / ticksPerNs / 1e6 << " ms"
+             << " (" << h.count() << " calls)\n";
+    }
+    cout.unsetf(ios::fixed);
+    cout.precision(oldPrecision);
+    printCounters();
+}
+
+// Per phase and call: cycles, instructions, IPC, and cache / branch
+// misses as a share of references / branches and per 1000 instructions.
+void TickProfiler::printCounters() const {
+    if (!perfStatus.empty()) {
+        cout << "Hardware counters unavailable (" << perfStatus << ")\n";
+    }
+    if (!perf.isOpen()) {
+        return;
+    }
+    auto missRate = [&](const uint64_t* c, HwCounter misses, HwCounter refs) {
+        const int m = static_cast<int>(misses);
+        const int r = static_cast<int>(refs);
+        const int instr = static_cast<int>(HwCounter::Instructions);
+        ostringstream text;
+        text << fixed << setprecision(2);
+        if (!perf.has(misses)) {
+            text << "n/a";
+            return text.str();
+        }
+        if (perf.has(refs) && c[r] > 0) {
+            text << 100.0 * c[m] / c[r] << "% ";
+        }
+        text << (c[instr] > 0 ? 1000.0 * c[m] / c[instr] : 0.0) << "/ki";
+        return text.str();
+    };
+
+    streamsize oldPrecision = cout.precision();
+    cout << fixed << "Hardware counters (user space, per call):\n";
+    for (int k = 0; k < static_cast<int>(TickPhase::Count); ++k) {
+        uint64_t calls = phases[k].count();
+        if (calls == 0) {
+            continue;
+        }
+        const uint64_t* c = counts[k];
+        uint64_t cycles = c[static_cast<int>(HwCounter::Cycles)];
+        uint64_t instr = c[static_cast<int>(HwCounter::Instructions)];
+        cout << "  " << left << setw(9) << TICK_PHASE_NAMES[k] << right << setprecision(0)
+             << "cycles " << static_cast<double>(cycles) / calls;
+        if (perf.has(HwCounter::Instructions)) {
+            cout << ", instr " << static_cast<double>(instr) / calls << setprecision(2)
+                 << ", IPC " << (cycles > 0 ? static_cast<double>(instr) / cycles : 0.0);
+        }
+        cout << ", cache miss " << missRate(c, HwCounter::CacheMisses, HwCounter::CacheRefs)
+             << ", branch miss " << missRate(c, HwCounter::BranchMisses, HwCounter::Branches)
+             << "\n";
+    }
+    cout.unsetf(ios::fixed);
+    cout.precision(oldPrecision);
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(profiler, phase) \
+    ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(profiler, phase)
+
+#else
+#define PROFILE_SCOPE(profiler, phase)
+#endif
+
+// ================== ElevatorSystem ==================
+
+// ElevatorSystem's scalar state: the System section of a snapshot.
+struct SnapshotSystemState {
+    int32_t numFloors;
+    int32_t numElevators;
+    int32_t currentTime;
+    int32_t totalRequestsProcessed;
+    int32_t policy;
+    int32_t stopOrder;
+    int32_t directionPenalty;
+    int32_t queueWeight;
+    int32_t batchAssign;
+    int32_t batchBudgetMicros;
+    int32_t reassignInterval;
+    int32_t activeCars;
+    int64_t batchesSolved;
+    int64_t batchesByAuction;
+    int64_t batchFallbacks;
+    int64_t callsReassigned;
+    uint64_t stopWords;
+};
+
+class ElevatorSystem {
+private:
+    // Beyond this size printBuildingView() switches to the compact view
+    static const int FULL_VIEW_MAX_FLOORS = 40;
+    static const size_t FULL_VIEW_MAX_ELEVATORS = 10;
+    // A waiting call only moves to a car at least this much cheaper, back
+    // to the car it last left only if REBOUND_MARGIN cheaper, and at most
+    // MAX_CALL_MOVES times, so calls cannot bounce between cars.
+    static const int REASSIGN_MARGIN = 2;
+    static const int REBOUND_MARGIN = 8;
+    static const int MAX_CALL_MOVES = 2;
+
+    int numFloors;
+    ElevatorFleet fleet;
+    vector<Request> pendingRequests;
+    int currentTime;
+    SimLog log;
+    string logPath;
+    int totalRequestsProcessed;
+    bool verbose;               // console messages from addRequest()
+    DispatchPolicy policy;
+    ScoreKernel scoreKernel;    // Heuristic policy
+    DispatchParams dispatch;
+
+    // Batch assignment (see assignBatch)
+    bool batchAssign;
+    int batchBudgetMicros;
+    int batchThreads;
+    AssignmentSolver solver;
+    vector<int> batchCost;
+    vector<int> batchMatch;
+    vector<int> requestCar;     // per pending request: matched car or -1
+    long long batchesSolved;
+    long long batchesByAuction;
+    long long batchFallbacks;
+    int activeCars;             // cars not idle after the last step
+    TripTracker trips;
+
+    // Revocable hall calls (see reassignWith)
+    int reassignInterval;       // ticks between passes, 0 = calls are final
+    long long callsReassigned;
+    vector<uint8_t> carDirty;   // scratch: fleet.changed at pass start
+    vector<size_t> dirtyCars;
+
+#ifdef ELEVATOR_PROFILE
+    TickProfiler profiler;
+#endif
+
+    // Event engine scratch state, reused across advanceTo() calls
+    vector<pair<int, int>> events;   // (time, car) min-heap
+    vector<int> carClock;            // time each car has been simulated to
+
+    // Assignment of pending requests to elevators, as the first phase of
+    // tick `now`, by the selected policy.
+    void assignRequests(int now) {
+        if (pendingRequests.empty()) {
+            return;
+        }
+        PROFILE_SCOPE(profiler, TickPhase::Assign);
+        withPolicy([&](const auto& chooser) { assignWith(now, chooser); });
+    }
+
+    // Second phase of tick `now`, every reassignInterval ticks.
+    void reassignCalls(int now) {
+        if (reassignInterval > 0 && now % reassignInterval == 0) {
+            PROFILE_SCOPE(profiler, TickPhase::Reassign);
+            withPolicy([&](const auto& chooser) { reassignWith(now, chooser); });
+        }
+    }
+
+    // Calls fn with the selected policy object.
+    template <typename Fn>
+    void withPolicy(Fn fn) {
+        switch (policy) {
+            case DispatchPolicy::Nearest:
+                fn(NearestCarPolicy());
+                break;
+            case DispatchPolicy::Heuristic:
+                fn(HeuristicPolicy{scoreKernel, dispatch});
+                break;
+            case DispatchPolicy::Collective:
+                fn(CollectivePolicy());
+                break;
+            case DispatchPolicy::Eta:
+                fn(EtaPolicy());
+                break;
+            case DispatchPolicy::Destination:
+                fn(DestinationPolicy());
+                break;
+        }
+    }
+
+    // Whether a rider's destination only becomes a stop once they board.
+    // Needed by SCAN, and by revocable calls so a moved call leaves no
+    // destination stop behind on its old car.
+    bool destinationAtBoarding() const {
+        return fleet.order == StopOrder::Scan || reassignInterval > 0;
+    }
+
+    /*
+       Optimal matching of this tick's requests to distinct cars by the
+       policy's cost, fixed in requestCar. With more requests than cars
+       the matrix is transposed and the unmatched requests are left to the
+       greedy pass. Returns false, leaving every request to the greedy
+       pass, if the solver misses its time budget.
+    */
+    template <typename Policy>
+    bool assignBatch(const Policy& chooser) {
+        auto deadline = chrono::steady_clock::now() + chrono::microseconds(batchBudgetMicros);
+        const size_t requests = pendingRequests.size();
+        const size_t cars = fleet.size();
+        const bool transposed = requests > cars;
+        const size_t rows = transposed ? cars : requests;
+        const size_t cols = transposed ? requests : cars;
+
+        batchCost.resize(rows * cols);
+        for (size_t r = 0; r < requests; ++r) {
+            for (size_t c = 0; c < cars; ++c) {
+                int cost = chooser.cost(fleet, c, pendingRequests[r]);
+                batchCost[transposed ? c * requests + r : r * cars + c] = cost;
+            }
+        }
+
+        bool usedAuction = false;
+        if (!solver.solve(batchCost.data(), static_cast<int>(rows), static_cast<int>(cols),
+                          batchMatch, deadline, batchThreads, usedAuction)) {
+            ++batchFallbacks;
+            return false;
+        }
+        ++batchesSolved;
+        batchesByAuction += usedAuction ? 1 : 0;
+
+        // A match to a car out of service leaves its request to greedy
+        requestCar.assign(requests, -1);
+        for (size_t row = 0; row < rows; ++row) {
+            int col = batchMatch[row];
+            if (col >= 0 && !fleet.outOfService[transposed ? row : col]) {
+                if (transposed) {
+                    requestCar[col] = static_cast<int>(row);
+                } else {
+                    requestCar[row] = col;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Each request is offered to the whole fleet, which sees earlier
+    // assignments of the same tick. Requests no car can take are
+    // compacted in place, so the queue keeps both its capacity (no
+    // allocation once warm) and its timeRequested order.
+    template <typename Policy>
+    void assignWith(int now, const Policy& chooser) {
+        const bool matched = batchAssign && pendingRequests.size() > 1 && fleet.size() > 1 &&
+                             assignBatch(chooser);
+        size_t kept = 0;
+        for (size_t r = 0; r < pendingRequests.size(); ++r) {
+            const Request& req = pendingRequests[r];
+            int bestIndex = matched && requestCar[r] >= 0 ? requestCar[r]
+                                                          : chooser.choose(fleet, req);
+
+            if (bestIndex != -1) {
+                bool boardNow = fleet.doorOpen[bestIndex] &&
+                                fleet.currentFloor[bestIndex] == req.fromFloor;
+                trips.onAssigned(bestIndex, req, now, boardNow);
+
+                if (destinationAtBoarding()) {
+                    // The destination becomes a stop once the rider boards
+                    // (see openDoor), so it cannot be visited before pickup
+                    fleet.addTarget(bestIndex, boardNow ? req.toFloor : req.fromFloor);
+                } else {
+                    // First go to pickup, then to destination
+                    fleet.addTarget(bestIndex, req.fromFloor);
+                    fleet.addTarget(bestIndex, req.toFloor);
+                }
+                ++totalRequestsProcessed;
+            } else {
+                pendingRequests[kept++] = req;
+            }
+        }
+        pendingRequests.erase(pendingRequests.begin() + kept, pendingRequests.end());
+    }
+
+    /*
+       Hall calls stay revocable until pickup: each waiting call is offered
+       again and moves to a car that is now at least REASSIGN_MARGIN
+       cheaper by the policy's cost (REBOUND_MARGIN for the car it last
+       left), until it has moved MAX_CALL_MOVES times. Its own car is
+       costed with the call's pickup withdrawn, as a new call would see it.
+       A policy's cost depends only on a car's floor, stops, direction and
+       door, so only cars where one of those changed since the last pass
+       (fleet.changed; every moving car) can have turned better or worse.
+       A call on an unchanged car is only checked against the changed
+       ones, and a pass where every car stood still costs one scan of the
+       flags. The pickup is only withdrawn once another car could take
+       the call, and only if the policy's cost of the car as it stands
+       does not already rule a move out; it is put back exactly if no
+       move follows.
+    */
+    template <typename Policy>
+    void reassignWith(int now, const Policy& chooser) {
+        const size_t n = fleet.size();
+        carDirty.assign(fleet.changed.begin(), fleet.changed.end());
+        fill(fleet.changed.begin(), fleet.changed.end(), 0);
+        dirtyCars.clear();
+        for (size_t i = 0; i < n; ++i) {
+            if (carDirty[i]) {
+                dirtyCars.push_back(i);
+            }
+        }
+        if (dirtyCars.empty()) {
+            return;
+        }
+
+        for (size_t c = 0; c < n; ++c) {
+            const int car = static_cast<int>(c);
+            for (int call = trips.firstWaiting(car); call >= 0; ) {
+                const int next = trips.nextWaiting(call);
+                if (trips.timesMoved(call) >= MAX_CALL_MOVES) {
+                    call = next;
+                    continue;
+                }
+                const Request req = trips.waitingCall(call);
+                const int leftCar = trips.movedFrom(call);
+
+                // Cheapest other car by cost plus the margin it must beat
+                int best = -1;
+                int bestNeed = numeric_limits<int>::max();
+                auto consider = [&](size_t other) {
+                    if (other != c && !fleet.outOfService[other]) {
+                        const int margin = static_cast<int>(other) == leftCar ? REBOUND_MARGIN
+                                                                              : REASSIGN_MARGIN;
+                        const int need = chooser.cost(fleet, other, req) + margin;
+                        if (need < bestNeed) {
+                            bestNeed = need;
+                            best = static_cast<int>(other);
+                        }
+                    }
+                };
+                if (carDirty[c]) {
+                    for (size_t other = 0; other < n; ++other) {
+                        consider(other);
+                    }
+                } else {
+                    for (size_t other : dirtyCars) {
+                        consider(other);
+                    }
+                }
+                if (best < 0) {
+                    call = next;
+                    continue;
+                }
+
+                // Its cost as it stands bounds the cost without the pickup
+                if (chooser.stopsOnlyAddCost() && bestNeed > chooser.cost(fleet, c, req)) {
+                    call = next;
+                    continue;
+                }
+                const uint8_t wasChanged = fleet.changed[c];
+                const bool revoked = !trips.sharesStop(car, call) &&
+                                     fleet.removeTarget(c, req.fromFloor);
+                if (bestNeed > chooser.cost(fleet, c, req)) {
+                    if (revoked) {
+                        fleet.restoreTarget(c, req.fromFloor);
+                    }
+                    fleet.changed[c] = wasChanged;
+                    call = next;
+                    continue;
+                }
+                bool boardNow = fleet.doorOpen[best] && fleet.currentFloor[best] == req.fromFloor;
+                trips.moveWaiting(car, call, best, now, boardNow);
+                fleet.addTarget(best, boardNow ? req.toFloor : req.fromFloor);
+                ++callsReassigned;
+                call = next;
+            }
+        }
+    }
+
+    // Read-only view of car i. The handle is returned const, so the
+    // const_cast never lets a const system be modified through it.
+    const Elevator car(size_t i) const {
+        return Elevator(const_cast<ElevatorFleet&>(fleet), static_cast<int>(i));
+    }
+
+    static void printCell(const Elevator& e) {
+        char dirChar = 'I';
+        switch (e.getDirection()) {
+            case Direction::Up:   dirChar = 'U'; break;
+            case Direction::Down: dirChar = 'D'; break;
+            case Direction::Idle: dirChar = 'I'; break;
+        }
+
+        string doorText = e.isDoorOpen() ? "Open" : "Closed";
+
+        // Example: [E0 U Open]
+        cout << "[E" << e.getId() << " " << dirChar << " " << doorText << "]";
+    }
+
+    // Print the vertical building view (ASCII-safe version).
+    // Small buildings get the full floor-by-elevator grid; larger ones only
+    // list occupied floors, so the cost depends on the fleet, not the height.
+    void printBuildingView() const {
+        cout << "Building view (top = highest floor)\n\n";
+
+        if (numFloors <= FULL_VIEW_MAX_FLOORS &&
+            fleet.size() <= FULL_VIEW_MAX_ELEVATORS) {
+            for (int floor = numFloors - 1; floor >= 0; --floor) {
+                cout << "Floor " << floor << " | ";
+
+                for (size_t i = 0; i < fleet.size(); ++i) {
+                    if (fleet.currentFloor[i] == floor) {
+                        printCell(car(i));
+                    } else {
+                        cout << "[            ]";
+                    }
+                }
+                cout << "\n";
+            }
+        } else {
+            vector<size_t> byFloor(fleet.size());
+            for (size_t i = 0; i < byFloor.size(); ++i) {
+                byFloor[i] = i;
+            }
+            const vector<int>& floors = fleet.currentFloor;
+            stable_sort(byFloor.begin(), byFloor.end(),
+                        [&floors](size_t a, size_t b) {
+                            return floors[a] > floors[b];
+                        });
+
+            int prevFloor = numFloors;
+            for (size_t i = 0; i < byFloor.size(); ) {
+                int floor = floors[byFloor[i]];
+                if (prevFloor - floor > 1) {
+                    cout << "   ... " << (prevFloor - floor - 1) << " empty floor(s)\n";
+                }
+                cout << "Floor " << floor << " | ";
+                for (; i < byFloor.size() && floors[byFloor[i]] == floor; ++i) {
+                    printCell(car(byFloor[i]));
+                }
+                cout << "\n";
+                prevFloor = floor;
+            }
+            if (prevFloor > 0) {
+                cout << "   ... " << prevFloor << " empty floor(s)\n";
+            }
+        }
+
+        cout << "\nLegend: U=Up, D=Down, I=Idle, Door: Open/Closed\n\n";
+    }
+
+    // Car i has just opened its door at time `now`: trips end and begin,
+    // and the boarding riders' destinations may become stops.
+    void openDoor(int i, int now) {
+        const bool addDestinations = destinationAtBoarding();
+        trips.onDoorOpen(i, fleet.currentFloor[i], now, [&](int toFloor) {
+            if (addDestinations) {
+                fleet.addTarget(i, toFloor);
+            }
+        });
+    }
+
+    // Assigns pending requests, then processes every door event up to and
+    // including `until`. Returns the time of the last event processed.
+    int runEvents(int until) {
+        assignRequests(currentTime + 1);
+        reassignCalls(currentTime + 1);
+        PROFILE_SCOPE(profiler, TickPhase::Events);
+
+        const size_t n = fleet.size();
+        carClock.assign(n, currentTime);
+        events.clear();
+        for (size_t i = 0; i < n; ++i) {
+            int dt = fleet.ticksToNextEvent(i);
+            if (dt >= 0 && dt <= until - currentTime) {
+                events.emplace_back(currentTime + dt, static_cast<int>(i));
+            }
+        }
+        auto later = greater<pair<int, int>>();
+        make_heap(events.begin(), events.end(), later);
+
+        int last = currentTime;
+        while (!events.empty()) {
+            pop_heap(events.begin(), events.end(), later);
+            int t = events.back().first;
+            int i = events.back().second;
+            events.pop_back();
+
+            fleet.advance(i, t - carClock[i]);
+            carClock[i] = t;
+            last = t;
+            if (fleet.doorOpen[i]) {
+                // Open events are the only ones that leave the door open
+                openDoor(i, t);
+            }
+
+            int dt = fleet.ticksToNextEvent(i);
+            if (dt >= 0 && dt <= until - t) {
+                events.emplace_back(t + dt, i);
+                push_heap(events.begin(), events.end(), later);
+            }
+        }
+        return last;
+    }
+
+    // Event runs stop short of the next reassignment pass: the pass must
+    // see every car where step() would have it.
+    int segmentEnd(int until) const {
+        if (reassignInterval <= 0) {
+            return until;
+        }
+        long long nextPass = (static_cast<long long>(currentTime + 1) / reassignInterval + 1) *
+                             reassignInterval;
+        return static_cast<int>(min<long long>(until, nextPass - 1));
+    }
+
+    // Nothing else happens before `until`: finish the straight runs
+    void finishRuns(int until) {
+        PROFILE_SCOPE(profiler, TickPhase::Events);
+        int active = 0;
+        for (size_t i = 0; i < fleet.size(); ++i) {
+            fleet.advance(i, until - carClock[i]);
+            active += fleet.isIdle(i) ? 0 : 1;
+        }
+        activeCars = active;
+        currentTime = until;
+    }
+
+public:
+    // An empty logPath disables the log file entirely.
+    ElevatorSystem(int floors, int numElevators,
+                   const string& logPath_ = "elevator_log.txt",
+                   const LogOptions& logOptions = LogOptions())
+        : numFloors(floors),
+          currentTime(0),
+          logPath(logPath_),
+          totalRequestsProcessed(0),
+          verbose(true),
+          policy(DispatchPolicy::Heuristic),
+          scoreKernel(defaultScoreKernel()),
+          batchAssign(false),
+          batchBudgetMicros(1000),
+          batchThreads(1),
+          batchesSolved(0),
+          batchesByAuction(0),
+          batchFallbacks(0),
+          activeCars(0),
+          reassignInterval(0),
+          callsReassigned(0)
+    {
+        // Room for a FIFO route through every floor twice (up to a cap),
+        // so ordinary loads never grow a stop ring inside step()
+        const size_t stopRing = min<size_t>(2 * static_cast<size_t>(max(floors, 1)), 256);
+        for (int i = 0; i < numElevators; ++i) {
+            fleet.add(0); // all start at floor 0
+            fleet.reserveStops(fleet.size() - 1, stopRing);
+            trips.addCar();
+        }
+
+        if (!logPath.empty()) {
+            log.open(logPath, logOptions, numFloors, numElevators);
+        }
+    }
+
+    ~ElevatorSystem() {
+        log.close(currentTime);
+    }
+
+    SimLog& getLog() { return log; }
+
+    int getNumFloors() const { return numFloors; }
+    int getCurrentTime() const { return currentTime; }
+    int getTotalRequestsProcessed() const { return totalRequestsProcessed; }
+
+    const TripTracker& getTrips() const { return trips; }
+
+    long long getTotalStopsServed() const {
+        long long total = 0;
+        for (int stops : fleet.totalStopsServed) {
+            total += stops;
+        }
+        return total;
+    }
+
+    void setVerbose(bool v) { verbose = v; }
+    void setScoreKernel(ScoreKernel k) { scoreKernel = k; }
+    void setDispatchParams(const DispatchParams& p) { dispatch = p; }
+    void setDispatchPolicy(DispatchPolicy p) { policy = p; }
+    DispatchPolicy getDispatchPolicy() const { return policy; }
+
+    // Solve each tick's requests as one assignment problem, falling back
+    // to greedy when a solve exceeds budgetMicros.
+    void setBatchAssignment(bool enabled, int budgetMicros, int threads) {
+        batchAssign = enabled;
+        batchBudgetMicros = budgetMicros;
+        batchThreads = threads;
+    }
+
+#ifdef ELEVATOR_PROFILE
+    // Adds perf_event counters to the tick profile (see PerfGroup).
+    bool enableHardwareCounters() { return profiler.enableHardwareCounters(); }
+#endif
+
+    // Re-optimize waiting hall calls every `interval` ticks (0 = never).
+    // Before the first request only, like setStopOrder().
+    void setReassignInterval(int interval) { reassignInterval = max(0, interval); }
+
+    // Before the first request, except FIFO to SCAN, which keeps every
+    // car's queued floors as its stop set (ElevatorFleet::convertToScan).
+    void setStopOrder(StopOrder o) {
+        if (o == fleet.order) {
+            return;
+        }
+        if (o == StopOrder::Scan) {
+            fleet.convertToScan(numFloors);
+        } else {
+            fleet.setStopOrder(o, numFloors);
+        }
+    }
+
+    StopOrder getStopOrder() const { return fleet.order; }
+
+    /*
+       Takes car out of service or puts it back. A car out of service is
+       offered no new calls. Its waiting calls go back to the pending
+       queue, keeping their request time, and their stops are dropped;
+       riders already on board are still taken to their floors, after
+       which the car stays idle.
+    */
+    void setInService(int car, bool inService) {
+        const uint8_t out = inService ? 0 : 1;
+        if (fleet.outOfService[car] == out) {
+            return;
+        }
+        fleet.outOfService[car] = out;
+        if (inService) {
+            --fleet.carsOutOfService;
+            return;
+        }
+        ++fleet.carsOutOfService;
+
+        while (trips.waitingCount(car) > 0) {
+            Request req = trips.dropWaiting(car, trips.firstWaiting(car));
+            auto later = upper_bound(pendingRequests.begin(), pendingRequests.end(), req,
+                                     [](const Request& a, const Request& b) {
+                                         return a.timeRequested < b.timeRequested;
+                                     });
+            pendingRequests.insert(later, req);
+            --totalRequestsProcessed;
+        }
+        for (int floor = fleet.lowestStop(car, -1); floor >= 0;
+             floor = fleet.stopAbove(car, floor)) {
+            if (!trips.ridingTo(car, floor)) {
+                fleet.removeTarget(car, floor);
+            }
+        }
+    }
+
+    /*
+       A copy of the running system to try something out on, e.g. from
+       runWhatIf(). Forking copies the flat per-car arrays (about 150
+       bytes per car, whatever the building's height) and the pending
+       queue; every car's stop queue or SCAN stop set, the rider pool and
+       the trip histograms are shared copy-on-write (see SharedVector)
+       and copied only when the child changes them. The
+       child has no log, prints nothing, and starts its own solver and
+       event-engine scratch state. Parent and children can then run on
+       different threads.
+    */
+    unique_ptr<ElevatorSystem> fork() const {
+        unique_ptr<ElevatorSystem> child(new ElevatorSystem(numFloors, 0, ""));
+        child->fleet = fleet;
+        child->pendingRequests = pendingRequests;
+        child->currentTime = currentTime;
+        child->totalRequestsProcessed = totalRequestsProcessed;
+        child->verbose = false;
+        child->policy = policy;
+        child->scoreKernel = scoreKernel;
+        child->dispatch = dispatch;
+        child->batchAssign = batchAssign;
+        child->batchBudgetMicros = batchBudgetMicros;
+        child->batchThreads = batchThreads;
+        child->batchesSolved = batchesSolved;
+        child->batchesByAuction = batchesByAuction;
+        child->batchFallbacks = batchFallbacks;
+        child->activeCars = activeCars;
+        child->trips = trips;
+        child->reassignInterval = reassignInterval;
+        child->callsReassigned = callsReassigned;
+        return child;
+    }
+
+    // Restarts the wait and ride histograms, e.g. at a fork.
+    void clearTripStatistics() { trips.clearStatistics(); }
+
+    long long getFloorsTraveled() const {
+        long long total = 0;
+        for (long long floors : fleet.floorsTraveled) {
+            total += floors;
+        }
+        return total;
+    }
+
+    /*
+       Writes the complete simulation state to `path`: cars and their
+       stops, pending requests, riders, statistics and dispatch settings.
+       The log, verbosity and solver thread count belong to the run and
+       are not saved. Returns the file size, or 0 on failure.
+    */
+    size_t saveSnapshot(const string& path) const {
+        const size_t n = fleet.size();
+        SnapshotSystemState st = {
+            numFloors, static_cast<int32_t>(n), currentTime, totalRequestsProcessed,
+            static_cast<int32_t>(policy), static_cast<int32_t>(fleet.order),
+            dispatch.directionPenalty, dispatch.queueWeight, batchAssign ? 1 : 0,
+            batchBudgetMicros, reassignInterval, activeCars,
+            batchesSolved, batchesByAuction, batchFallbacks, callsReassigned,
+            fleet.stopWords
+        };
+
+        SnapshotWriter out;
+        out.add(SnapshotSection::System, &st, 1);
+        out.add(SnapshotSection::CurrentFloor, fleet.currentFloor);
+        out.add(SnapshotSection::Direction, fleet.direction);
+        out.add(SnapshotSection::DoorOpen, fleet.doorOpen);
+        out.add(SnapshotSection::QueueHead, fleet.queueHead);
+        out.add(SnapshotSection::QueueSize, fleet.queueSize);
+        out.add(SnapshotSection::StopsServed, fleet.totalStopsServed);
+        out.add(SnapshotSection::FloorsTraveled, fleet.floorsTraveled);
+        out.add(SnapshotSection::Changed, fleet.changed);
+        out.add(SnapshotSection::RouteLegs, fleet.routeLegs);
+
+        vector<uint32_t> targetCounts(n);
+        vector<int> targets;
+        for (size_t i = 0; i < n; ++i) {
+            const TargetQueue& q = fleet.targets[i];
+            targetCounts[i] = static_cast<uint32_t>(q.size());
+            for (size_t k = 0; k < q.size(); ++k) {
+                targets.push_back(q.at(k));
+            }
+        }
+        out.add(SnapshotSection::TargetCounts, targetCounts);
+        out.add(SnapshotSection::Targets, targets);
+
+        // Stored flat, car after car
+        vector<uint64_t> stopBits;
+        vector<int> stopCounts;
+        for (size_t i = 0; i < n; ++i) {
+            const vector<uint64_t>& bits = fleet.stopBits[i].get();
+            const vector<int>& tree = fleet.stopCounts[i].get();
+            stopBits.insert(stopBits.end(), bits.begin(), bits.end());
+            stopCounts.insert(stopCounts.end(), tree.begin(), tree.end());
+        }
+        out.add(SnapshotSection::StopBits, stopBits);
+        out.add(SnapshotSection::StopCounts, stopCounts);
+        out.add(SnapshotSection::TopStop, fleet.topStop);
+        out.add(SnapshotSection::BottomStop, fleet.bottomStop);
+        out.add(SnapshotSection::Pending, pendingRequests);
+        out.add(SnapshotSection::OutOfService, fleet.outOfService);
+        trips.save(out);
+        return out.write(path);
+    }
+
+    // Replaces the whole state with a snapshot taken from a system with
+    // the same floors and cars (see snapshotDimensions()). On failure the
+    // system is left half restored and should be discarded.
+    bool restoreSnapshot(const SnapshotReader& in, string& error) {
+        SnapshotSystemState st;
+        if (!in.readOne(SnapshotSection::System, st)) {
+            error = "snapshot has no system section";
+            return false;
+        }
+        const size_t n = fleet.size();
+        if (st.numFloors != numFloors || st.numElevators != static_cast<int32_t>(n)) {
+            error = "snapshot is for " + to_string(st.numFloors) + " floors and " +
+                    to_string(st.numElevators) + " elevators";
+            return false;
+        }
+
+        if (st.policy < static_cast<int32_t>(DispatchPolicy::Nearest) ||
+            st.policy > static_cast<int32_t>(DispatchPolicy::Destination) ||
+            st.stopOrder < static_cast<int32_t>(StopOrder::Fifo) ||
+            st.stopOrder > static_cast<int32_t>(StopOrder::Scan) ||
+            st.activeCars < 0 || st.activeCars > static_cast<int32_t>(n)) {
+            error = "snapshot is incomplete or inconsistent";
+            return false;
+        }
+
+        currentTime = st.currentTime;
+        totalRequestsProcessed = st.totalRequestsProcessed;
+        policy = static_cast<DispatchPolicy>(st.policy);
+        dispatch.directionPenalty = st.directionPenalty;
+        dispatch.queueWeight = st.queueWeight;
+        batchAssign = st.batchAssign != 0;
+        batchBudgetMicros = st.batchBudgetMicros;
+        reassignInterval = st.reassignInterval;
+        activeCars = st.activeCars;
+        batchesSolved = st.batchesSolved;
+        batchesByAuction = st.batchesByAuction;
+        batchFallbacks = st.batchFallbacks;
+        callsReassigned = st.callsReassigned;
+        fleet.setStopOrder(static_cast<StopOrder>(st.stopOrder), numFloors);
+
+        const uint32_t* targetCounts = nullptr;
+        const int* targets = nullptr;
+        const uint64_t* stopBits = nullptr;
+        const int* stopCounts = nullptr;
+        size_t cars = 0;
+        size_t totalTargets = 0;
+        size_t bitWords = 0;
+        size_t treeWords = 0;
+        const size_t words = n * fleet.stopWords;
+        bool ok = st.stopWords == fleet.stopWords &&
+                  in.read(SnapshotSection::CurrentFloor, fleet.currentFloor, n) &&
+                  in.read(SnapshotSection::Direction, fleet.direction, n) &&
+                  in.read(SnapshotSection::DoorOpen, fleet.doorOpen, n) &&
+                  in.read(SnapshotSection::QueueHead, fleet.queueHead, n) &&
+                  in.read(SnapshotSection::QueueSize, fleet.queueSize, n) &&
+                  in.read(SnapshotSection::StopsServed, fleet.totalStopsServed, n) &&
+                  in.read(SnapshotSection::FloorsTraveled, fleet.floorsTraveled, n) &&
+                  in.read(SnapshotSection::Changed, fleet.changed, n) &&
+                  in.read(SnapshotSection::RouteLegs, fleet.routeLegs, n) &&
+                  in.get(SnapshotSection::StopBits, stopBits, bitWords) && bitWords == words &&
+                  in.get(SnapshotSection::StopCounts, stopCounts, treeWords) &&
+                  treeWords == words &&
+                  in.read(SnapshotSection::TopStop, fleet.topStop, n) &&
+                  in.read(SnapshotSection::BottomStop, fleet.bottomStop, n) &&
+                  in.read(SnapshotSection::Pending, pendingRequests) &&
+                  in.get(SnapshotSection::TargetCounts, targetCounts, cars) && cars == n &&
+                  in.get(SnapshotSection::Targets, targets, totalTargets) &&
+                  trips.restore(in, numFloors);
+        size_t used = 0;
+        fleet.crowded.assign(n, 0);
+        fleet.crowdedRings = 0;
+        for (size_t i = 0; ok && i < n; ++i) {
+            const size_t w = i * fleet.stopWords;
+            fleet.stopBits[i] = SharedVector<uint64_t>(
+                vector<uint64_t>(stopBits + w, stopBits + w + fleet.stopWords));
+            fleet.stopCounts[i] = SharedVector<int>(
+                vector<int>(stopCounts + w, stopCounts + w + fleet.stopWords));
+            TargetQueue& q = fleet.targets[i];
+            q.clear();
+            ok = targetCounts[i] <= totalTargets - used;
+            for (uint32_t k = 0; ok && k < targetCounts[i]; ++k) {
+                q.push_back(targets[used++]);
+            }
+        }
+        // Absent from snapshots taken before cars could leave service
+        if (ok && !in.read(SnapshotSection::OutOfService, fleet.outOfService, n)) {
+            fleet.outOfService.assign(n, 0);
+        }
+        ok = ok && used == totalTargets;
+        for (size_t i = 0; ok && i < n; ++i) {
+            ok = fleet.consistent(i, numFloors);
+        }
+        for (size_t r = 0; ok && r < pendingRequests.size(); ++r) {
+            const Request& req = pendingRequests[r];
+            ok = req.fromFloor >= 0 && req.fromFloor < numFloors && req.toFloor >= 0 &&
+                 req.toFloor < numFloors && req.fromFloor != req.toFloor &&
+                 req.passengers >= 1 &&
+                 (r == 0 || pendingRequests[r - 1].timeRequested <= req.timeRequested);
+        }
+        if (!ok) {
+            error = "snapshot is incomplete or inconsistent";
+            return false;
+        }
+        fleet.carsOutOfService = static_cast<size_t>(
+            count(fleet.outOfService.begin(), fleet.outOfService.end(), 1));
+        trips.reserve(pendingRequests.size());
+        return true;
+    }
+
+    // Returns false (and leaves the system untouched) for invalid requests.
+    bool addRequest(int fromFloor, int toFloor, int passengers = 1) {
+        if (fromFloor < 0 || fromFloor >= numFloors ||
+            toFloor   < 0 || toFloor   >= numFloors) {
+            if (verbose) {
+                cout << "Invalid request. Floors must be between 0 and "
+                     << numFloors - 1 << ".\n";
+            }
+            return false;
+        }
+        if (fromFloor == toFloor) {
+            if (verbose) {
+                cout << "You are already on that floor.\n";
+            }
+            return false;
+        }
+
+        pendingRequests.emplace_back(fromFloor, toFloor, currentTime, max(1, passengers));
+        // Storage for assigning it is made here, so step() need not allocate
+        trips.reserve(pendingRequests.size());
+        if (fleet.crowdedRings > 0) {
+            fleet.widenRings();
+        }
+        if (verbose) {
+            cout << "Request added from floor " << fromFloor
+                 << " to floor " << toFloor << ".\n";
+        }
+        return true;
+    }
+
+    void step() {
+        PROFILE_SCOPE(profiler, TickPhase::Tick);
+        ++currentTime;
+
+        assignRequests(currentTime);
+        reassignCalls(currentTime);
+
+        {
+            PROFILE_SCOPE(profiler, TickPhase::Cars);
+            int active = 0;
+            for (size_t i = 0; i < fleet.size(); ++i) {
+                if (fleet.step(i)) {
+                    openDoor(static_cast<int>(i), currentTime);
+                }
+                active += fleet.isIdle(i) ? 0 : 1;
+            }
+            activeCars = active;
+        }
+
+        if (log.isOpen()) {
+            PROFILE_SCOPE(profiler, TickPhase::Log);
+            for (size_t i = 0; i < fleet.size(); ++i) {
+                log.write(LogRecord::status(currentTime, static_cast<int>(i),
+                                            fleet.currentFloor[i], fleet.getDirection(i),
+                                            fleet.doorOpen[i] != 0, fleet.queueSize[i]));
+            }
+        }
+    }
+
+    // The assignment phase of the next tick on its own, for benchmarks.
+    void assignPending() { assignRequests(currentTime + 1); }
+
+    // True when every car is idle and nothing is waiting to be assigned,
+    // i.e. further steps cannot change anything but the clock.
+    bool isQuiescent() const {
+        return activeCars == 0 && pendingRequests.empty();
+    }
+
+    // Idle fast-forward for the tick engine: if the system is quiescent,
+    // jump the clock to `until` and write one record for the whole
+    // interval instead of a line per elevator per tick. Returns whether
+    // the jump happened.
+    bool fastForwardTo(int until) {
+        if (until <= currentTime || !isQuiescent()) {
+            return false;
+        }
+        if (log.isOpen()) {
+            log.idleSpan(currentTime + 1, until);
+        }
+        currentTime = until;
+        return true;
+    }
+
+    /*
+       advanceTo() is the discrete-event counterpart of step(): it leaves
+       the system exactly as (until - currentTime) calls to step() would,
+       but without per-tick logging. Every car's next door open/close is
+       kept on a priority queue and cars are only touched at those events;
+       between them they travel in a single jump. Requests added before
+       the call are assigned first, as step() would do on its first tick.
+    */
+    void advanceTo(int until) {
+        while (until > currentTime) {
+            int end = segmentEnd(until);
+            runEvents(end);
+            finishRuns(end);
+        }
+    }
+
+    // Event-driven run until every car is idle; the clock stops where the
+    // tick engine would first report isQuiescent().
+    void advanceUntilQuiescent() {
+        for (;;) {
+            int end = segmentEnd(numeric_limits<int>::max());
+            int last = runEvents(end);
+            bool busy = false;
+            for (size_t i = 0; i < fleet.size() && !busy; ++i) {
+                busy = fleet.ticksToNextEvent(i) >= 0;
+            }
+            if (!busy) {
+                finishRuns(max(last, currentTime));
+                return;
+            }
+            finishRuns(end);
+        }
+    }
+
+    void printStatus() const {
+        cout << "\n=== Time step: " << currentTime << " ===\n";
+
+        // Visual building representation
+        printBuildingView();
+
+        // Detailed per-elevator info
+        cout << "Elevator details:\n";
+        for (size_t i = 0; i < fleet.size(); ++i) {
+            car(i).printStatus();
+        }
+
+        cout << "Pending requests: " << pendingRequests.size() << "\n";
+    }
+
+    void printSummary() const {
+        cout << "\n===== Simulation Summary =====\n";
+        cout << "Total time steps: " << currentTime << "\n";
+        cout << "Total requests processed (assigned): " << totalRequestsProcessed << "\n";
+        for (size_t i = 0; i < fleet.size(); ++i) {
+            cout << "Elevator " << i
+                 << " served stops: " << fleet.totalStopsServed[i] << "\n";
+        }
+        trips.getWaitTimes().print("Wait time", "ticks");
+        trips.getRideTimes().print("Ride time", "ticks");
+        cout << "Requests still in flight: " << trips.getInFlight() << "\n";
+        cout << "Floors traveled: " << getFloorsTraveled() << "\n";
+        if (reassignInterval > 0) {
+            cout << "Hall calls reassigned: " << callsReassigned << "\n";
+        }
+        if (batchAssign) {
+            cout << "Batch assignment: " << batchesSolved << " batches solved ("
+                 << batchesByAuction << " by auction), " << batchFallbacks
+                 << " fell back to greedy\n";
+        }
+#ifdef ELEVATOR_PROFILE
+        profiler.print();
+#endif
+        if (!logPath.empty()) {
+            cout << "Log saved to " << logPath << " (if file I/O is allowed).\n";
+        }
+    }
+};
+
+// Floors and cars of the system a snapshot was taken from.
+bool snapshotDimensions(const SnapshotReader& in, int& floors, int& elevators) {
+    SnapshotSystemState st;
+    if (!in.readOne(SnapshotSection::System, st)) {
+        return false;
+    }
+    floors = st.numFloors;
+    elevators = st.numElevators;
+    return true;
+}
+
+// ================== Workload ==================
+
+// A source of requests ordered by time. nextTime() is the timestamp of the
+// next request (or NO_MORE_REQUESTS once exhausted); a request stamped t is
+// injected when the simulation clock reads t, i.e. before step t + 1.
+class WorkloadSource {
+public:
+    static const int NO_MORE_REQUESTS = numeric_limits<int>::max();
+
+    virtual ~WorkloadSource() {}
+    virtual int nextTime() const = 0;
+    virtual Request next() = 0;
+};
+
+// Uniform random traffic: Poisson arrivals at `rate` requests per tick,
+// origin and destination drawn uniformly from distinct floors.
+class RandomWorkload : public WorkloadSource {
+private:
+    int numFloors;
+    mt19937_64 rng;
+    exponential_distribution<double> gap;
+    double clock;
+
+    void advance() { clock += gap(rng); }
+
+public:
+    RandomWorkload(int floors, double rate, uint64_t seed)
+        : numFloors(floors), rng(seed),
+          gap(rate > 0 ? rate : 1.0), clock(0.0)
+    {
+        if (rate > 0 && floors > 1) {
+            advance();
+        } else {
+            clock = NO_MORE_REQUESTS;
+        }
+    }
+
+    int nextTime() const override {
+        return clock >= NO_MORE_REQUESTS ? NO_MORE_REQUESTS
+                                         : static_cast<int>(clock);
+    }
+
+    Request next() override {
+        int t = nextTime();
+        uniform_int_distribution<int> pick(0, numFloors - 1);
+        int from = pick(rng);
+        int to = pick(rng);
+        while (to == from) {
+            to = pick(rng);
+        }
+        advance();
+        return Request(from, to, t);
+    }
+};
+
+// Replays requests recorded by recordWorkload(). The vector is only read,
+// so one recording can drive any number of simulations, on any thread.
+class RecordedWorkload : public WorkloadSource {
+private:
+    const vector<Request>* requests;
+    size_t position;
+
+public:
+    explicit RecordedWorkload(const vector<Request>& recorded)
+        : requests(&recorded), position(0) {}
+
+    int nextTime() const override {
+        return position < requests->size() ? (*requests)[position].timeRequested
+                                           : NO_MORE_REQUESTS;
+    }
+
+    Request next() override { return (*requests)[position++]; }
+};
+
+// Drains every request of `source` stamped before `until`.
+vector<Request> recordWorkload(WorkloadSource& source, int until) {
+    vector<Request> recorded;
+    while (source.nextTime() < until) {
+        recorded.push_back(source.next());
+    }
+    return recorded;
+}
+
+// ================== Traffic generation ==================
+
+// xoshiro256** seeded through splitmix64: fast, small and reproducible
+// across platforms, unlike the distributions in <random>.
+class FastRng {
+private:
+    uint64_t state[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+    explicit FastRng(uint64_t seed) {
+        for (uint64_t& word : state) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, 1)
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    // Exactly 1 - uniform(), in (0, 1], so its log is always finite
+    double uniformPositive() {
+        return (9007199254740992ULL - (next() >> 11)) * (1.0 / 9007199254740992.0);
+    }
+
+    // Uniform in [0, n) without modulo bias worth caring about (n < 2^32)
+    uint32_t below(uint32_t n) {
+        return static_cast<uint32_t>(((next() >> 32) * n) >> 32);
+    }
+};
+
+// Walker alias table: O(n) to build, O(1) to sample from any discrete
+// distribution with a single 64-bit draw (high half picks the column, low
+// half is compared against its 32-bit threshold).
+class AliasTable {
+private:
+    vector<uint32_t> threshold;
+    vector<uint32_t> alias;
+
+public:
+    AliasTable() {}
+
+    explicit AliasTable(const vector<double>& weights) {
+        const size_t n = weights.size();
+        double total = 0;
+        for (double w : weights) {
+            total += w > 0 ? w : 0;
+        }
+        vector<double> prob(n, 1.0);
+        alias.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            alias[k] = static_cast<uint32_t>(k);
+        }
+        if (n == 0 || total <= 0) {
+            threshold.assign(n, numeric_limits<uint32_t>::max());
+            return;
+        }
+
+        vector<double> scaled(n);
+        vector<uint32_t> small, large;
+        for (size_t k = 0; k < n; ++k) {
+            scaled[k] = (weights[k] > 0 ? weights[k] : 0) * n / total;
+            (scaled[k] < 1.0 ? small : large).push_back(static_cast<uint32_t>(k));
+        }
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            prob[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        threshold.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            threshold[k] = prob[k] >= 1.0 ? numeric_limits<uint32_t>::max()
+                                          : static_cast<uint32_t>(prob[k] * 4294967296.0);
+        }
+    }
+
+    size_t size() const { return threshold.size(); }
+
+    uint32_t sample(FastRng& rng) const {
+        uint64_t bits = rng.next();
+        uint32_t k = static_cast<uint32_t>(((bits >> 32) * threshold.size()) >> 32);
+        return static_cast<uint32_t>(bits) < threshold[k] ? k : alias[k];
+    }
+};
+
+/*
+   A traffic pattern is an origin-destination matrix stored as a weighted
+   mixture of flows. Each flow draws its origin and destination
+   independently from floor ranges, so the standard patterns cost O(floors)
+   memory; an explicit dense matrix becomes one flow per origin floor.
+*/
+class TrafficPattern {
+private:
+    struct FloorRange {
+        int lo;
+        AliasTable weights;         // empty = uniform over [lo, lo + count)
+        int count;
+
+        int sample(FastRng& rng) const {
+            return lo + static_cast<int>(weights.size() ? weights.sample(rng)
+                                                        : rng.below(static_cast<uint32_t>(count)));
+        }
+    };
+
+    struct Flow {
+        FloorRange origin;
+        FloorRange destination;
+    };
+
+    vector<Flow> flows;
+    vector<double> flowWeights;
+    AliasTable flowTable;
+
+    void addFlow(double weight, int originLo, int originCount, int destLo, int destCount) {
+        if (weight <= 0 || originCount <= 0 || destCount <= 0) {
+            return;
+        }
+        flows.push_back({{originLo, AliasTable(), originCount},
+                         {destLo, AliasTable(), destCount}});
+        flowWeights.push_back(weight);
+    }
+
+    void finish() { flowTable = AliasTable(flowWeights); }
+
+public:
+    // Lobby is floor 0; "upper" floors are 1 .. floors - 1
+    static TrafficPattern upPeak(int floors) {
+        TrafficPattern p;
+        p.addFlow(0.90, 0, 1, 1, floors - 1);           // arrivals from the lobby
+        p.addFlow(0.05, 1, floors - 1, 1, floors - 1);  // interfloor
+        p.addFlow(0.05, 1, floors - 1, 0, 1);           // early leavers
+        p.finish();
+        return p;
+    }
+
+    static TrafficPattern downPeak(int floors) {
+        TrafficPattern p;
+        p.addFlow(0.90, 1, floors - 1, 0, 1);
+        p.addFlow(0.05, 1, floors - 1, 1, floors - 1);
+        p.addFlow(0.05, 0, 1, 1, floors - 1);
+        p.finish();
+        return p;
+    }
+
+    static TrafficPattern lunch(int floors) {
+        TrafficPattern p;
+        p.addFlow(0.40, 1, floors - 1, 0, 1);
+        p.addFlow(0.40, 0, 1, 1, floors - 1);
+        p.addFlow(0.20, 1, floors - 1, 1, floors - 1);
+        p.finish();
+        return p;
+    }
+
+    static TrafficPattern interfloor(int floors) {
+        TrafficPattern p;
+        p.addFlow(1.0, 0, floors, 0, floors);
+        p.finish();
+        return p;
+    }
+
+    // weights[from * floors + to] is the relative demand from -> to
+    static TrafficPattern fromMatrix(int floors, const vector<double>& weights) {
+        TrafficPattern p;
+        for (int from = 0; from < floors; ++from) {
+            vector<double> row(weights.begin() + static_cast<size_t>(from) * floors,
+                               weights.begin() + static_cast<size_t>(from + 1) * floors);
+            row[from] = 0;
+            double total = 0;
+            for (double w : row) {
+                total += w > 0 ? w : 0;
+            }
+            if (total > 0) {
+                p.flows.push_back({{from, AliasTable(), 1}, {0, AliasTable(row), floors}});
+                p.flowWeights.push_back(total);
+            }
+        }
+        p.finish();
+        return p;
+    }
+
+    bool empty() const { return flows.empty(); }
+
+    // Draws one trip; false in the rare case no distinct pair turned up
+    bool sample(FastRng& rng, int& from, int& to) const {
+        for (int attempt = 0; attempt < 8; ++attempt) {
+            const Flow& f = flows.size() == 1 ? flows[0] : flows[flowTable.sample(rng)];
+            from = f.origin.sample(rng);
+            to = f.destination.sample(rng);
+            if (from != to) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/*
+   Poisson arrivals with a piecewise-constant, periodic rate: each segment
+   of the schedule has its own rate (requests per tick) and pattern.
+   Inter-arrival gaps are exponential; when a gap crosses a segment
+   boundary the clock restarts at the boundary, which is exact because the
+   process is memoryless.
+*/
+class TrafficGenerator {
+public:
+    struct Segment {
+        int length;                 // ticks
+        double rate;                // requests per tick
+        int pattern;                // index into the generator's patterns
+    };
+
+private:
+    vector<TrafficPattern> patterns;
+    vector<Segment> schedule;
+    FastRng rng;
+    double clock;
+    double segmentEnd;
+    size_t segment;
+    bool active;
+
+public:
+    TrafficGenerator(const vector<TrafficPattern>& patterns_,
+                     const vector<Segment>& schedule_, uint64_t seed)
+        : patterns(patterns_), schedule(schedule_), rng(seed),
+          clock(0), segmentEnd(0), segment(0), active(false)
+    {
+        for (const Segment& seg : schedule) {
+            if (seg.length > 0 && seg.rate > 0 && !patterns[seg.pattern].empty()) {
+                active = true;
+            }
+        }
+        if (active) {
+            segmentEnd = schedule[0].length;
+        }
+    }
+
+    // A single pattern at a constant rate
+    TrafficGenerator(const TrafficPattern& pattern, double rate, uint64_t seed)
+        : TrafficGenerator(vector<TrafficPattern>(1, pattern),
+                           vector<Segment>(1, Segment{numeric_limits<int>::max(), rate, 0}),
+                           seed) {}
+
+    // Next request in time order; false once the clock leaves int range
+    // or no segment produces traffic.
+    bool next(Request& out) {
+        while (active) {
+            const Segment& seg = schedule[segment];
+            // -log(1 - u): plain log costs about half of log1p(-u)
+            double gap = seg.rate > 0 ? -log(rng.uniformPositive()) / seg.rate : segmentEnd;
+            if (clock + gap >= segmentEnd) {
+                clock = segmentEnd;
+                segment = (segment + 1) % schedule.size();
+                segmentEnd += schedule[segment].length;
+                if (clock >= WorkloadSource::NO_MORE_REQUESTS) {
+                    active = false;
+                }
+                continue;
+            }
+            clock += gap;
+
+            int from, to;
+            if (patterns[seg.pattern].sample(rng, from, to)) {
+                out = Request(from, to, static_cast<int>(clock));
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Typical office day over `period` ticks, repeating: quiet night, morning
+// up-peak, lunch, afternoon interfloor, evening down-peak. `rate` is the
+// peak rate; the other segments run at a fraction of it.
+TrafficGenerator makeOfficeDay(int floors, double rate, int period, uint64_t seed) {
+    vector<TrafficPattern> patterns = {
+        TrafficPattern::interfloor(floors), TrafficPattern::upPeak(floors),
+        TrafficPattern::lunch(floors), TrafficPattern::downPeak(floors)};
+    const struct { double share; double load; int pattern; } day[] = {
+        {0.30, 0.02, 0}, {0.10, 1.00, 1}, {0.10, 0.30, 0}, {0.08, 0.60, 2},
+        {0.12, 0.30, 0}, {0.10, 1.00, 3}, {0.20, 0.05, 0}};
+
+    vector<TrafficGenerator::Segment> schedule;
+    int used = 0;
+    for (size_t k = 0; k < sizeof(day) / sizeof(day[0]); ++k) {
+        bool last = k + 1 == sizeof(day) / sizeof(day[0]);
+        int length = last ? period - used : static_cast<int>(day[k].share * period);
+        used += length;
+        schedule.push_back({max(1, length), day[k].load * rate, day[k].pattern});
+    }
+    return TrafficGenerator(patterns, schedule, seed);
+}
+
+// Feeds a TrafficGenerator into the simulation, one request of lookahead.
+class GeneratedWorkload : public WorkloadSource {
+private:
+    TrafficGenerator gen;
+    Request upcoming;
+    bool haveNext;
+
+public:
+    explicit GeneratedWorkload(const TrafficGenerator& g)
+        : gen(g), upcoming(0, 0, 0), haveNext(false)
+    {
+        haveNext = gen.next(upcoming);
+    }
+
+    int nextTime() const override {
+        return haveNext ? upcoming.timeRequested : NO_MORE_REQUESTS;
+    }
+
+    Request next() override {
+        Request r = upcoming;
+        haveNext = gen.next(upcoming);
+        return r;
+    }
+};
+
+// Reads a floors x floors whitespace-separated weight matrix (row = origin).
+bool loadOdMatrix(const string& path, int floors, vector<double>& weights) {
+    ifstream in(path);
+    if (!in.is_open()) {
+        cerr << "Cannot read " << path << "\n";
+        return false;
+    }
+    weights.assign(static_cast<size_t>(floors) * floors, 0.0);
+    for (double& w : weights) {
+        if (!(in >> w)) {
+            cerr << path << ": expected " << floors << " x " << floors << " weights\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// ================== Trace replay ==================
+
+/*
+   Trace files hold one hall call per line, sorted by timestamp:
+
+       timestamp fromFloor toFloor [passengers]
+
+   Blank lines and lines starting with '#' are skipped. TraceWorkload
+   memory-maps the file and parses a single line ahead of the simulation,
+   handing already-consumed pages back to the kernel as it goes, so a
+   trace of any size replays in constant memory. Where mapping is not
+   possible (pipes, "-" for stdin) it falls back to streaming reads.
+*/
+class TraceWorkload : public WorkloadSource {
+private:
+    static const size_t RELEASE_CHUNK = 64 << 20;
+
+    // Memory-mapped input
+    const char* data;
+    size_t length;
+    size_t pos;
+    size_t released;
+    int fd;
+
+    // Streaming fallback
+    ifstream file;
+    istream* stream;
+    string line;
+
+    bool opened;
+    bool haveNext;
+    Request upcoming;
+    int lastTime;
+    long long malformed;
+    long long outOfOrder;
+
+    static void skipSpaces(const char*& p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == ',')) {
+            ++p;
+        }
+    }
+
+    static bool parseInt(const char*& p, const char* end, long long& value) {
+        skipSpaces(p, end);
+        bool negative = p < end && *p == '-';
+        if (negative) {
+            ++p;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+        value = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            const int digit = *p++ - '0';
+            if (value > (numeric_limits<long long>::max() - digit) / 10) {
+                return false;   // too long for any field
+            }
+            value = value * 10 + digit;
+        }
+        if (negative) {
+            value = -value;
+        }
+        return true;
+    }
+
+    // Parses [p, end) into `out`. Returns false for blank, comment and
+    // malformed lines (the latter are counted).
+    bool parseLine(const char* p, const char* end, Request& out) {
+        skipSpaces(p, end);
+        if (p == end || *p == '#') {
+            return false;
+        }
+
+        long long t, from, to, count = 1;
+        if (!parseInt(p, end, t) || !parseInt(p, end, from) || !parseInt(p, end, to)) {
+            ++malformed;
+            return false;
+        }
+        skipSpaces(p, end);
+        if (p < end && !parseInt(p, end, count)) {
+            ++malformed;
+            return false;
+        }
+        skipSpaces(p, end);
+        // Floors off the building are the simulation's to reject, but
+        // every field must survive the narrowing to int
+        const long long maxInt = numeric_limits<int>::max();
+        if (p != end || t < 0 || t >= NO_MORE_REQUESTS || from < 0 || from > maxInt ||
+            to < 0 || to > maxInt || count < 1 || count > maxInt) {
+            ++malformed;
+            return false;
+        }
+
+        if (t < lastTime) {
+            ++outOfOrder;   // replayed as soon as possible
+            t = lastTime;
+        }
+        lastTime = static_cast<int>(t);
+        out = Request(static_cast<int>(from), static_cast<int>(to), static_cast<int>(t),
+                      static_cast<int>(count));
+        return true;
+    }
+
+    void fetch() {
+        haveNext = false;
+        if (data) {
+            while (!haveNext && pos < length) {
+                const char* begin = data + pos;
+                const char* nl = static_cast<const char*>(memchr(begin, '\n', length - pos));
+                const char* end = nl ? nl : data + length;
+                haveNext = parseLine(begin, end, upcoming);
+                pos = static_cast<size_t>(end - data) + 1;
+            }
+#ifdef ELEVATOR_HAVE_MMAP
+            if (pos - released >= RELEASE_CHUNK) {
+                size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                size_t upTo = min(pos, length) / page * page;
+                madvise(const_cast<char*>(data) + released, upTo - released, MADV_DONTNEED);
+                released = upTo;
+            }
+#endif
+        } else if (stream) {
+            while (!haveNext && getline(*stream, line)) {
+                haveNext = parseLine(line.data(), line.data() + line.size(), upcoming);
+            }
+        }
+    }
+
+public:
+    explicit TraceWorkload(const string& path)
+        : data(nullptr), length(0), pos(0), released(0), fd(-1),
+          stream(nullptr), opened(false), haveNext(false), upcoming(0, 0, 0),
+          lastTime(0), malformed(0), outOfOrder(0)
+    {
+        if (path == "-") {
+            stream = &cin;
+            opened = true;
+        } else {
+#ifdef ELEVATOR_HAVE_MMAP
+            fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                void* m = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                               MAP_PRIVATE, fd, 0);
+                if (m != MAP_FAILED) {
+                    data = static_cast<const char*>(m);
+                    length = static_cast<size_t>(st.st_size);
+                    madvise(m, length, MADV_SEQUENTIAL);
+                    opened = true;
+                }
+            }
+#endif
+            if (!data) {
+                file.open(path);
+                opened = file.is_open();
+                stream = opened ? &file : nullptr;
+            }
+        }
+        fetch();
+    }
+
+    ~TraceWorkload() {
+#ifdef ELEVATOR_HAVE_MMAP
+        if (data) {
+            munmap(const_cast<char*>(data), length);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+
+    bool isOpen() const { return opened; }
+    long long getMalformed() const { return malformed; }
+    long long getOutOfOrder() const { return outOfOrder; }
+
+    int nextTime() const override {
+        return haveNext ? upcoming.timeRequested : NO_MORE_REQUESTS;
+    }
+
+    Request next() override {
+        Request r = upcoming;
+        fetch();
+        return r;
+    }
+};
+
+// ================== Helper ==================
+
+void clearInput() {
+    cin.clear();
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+}
+
+// ================== Batch mode ==================
+
+// Integer range lo..hi (inclusive) in steps of step, as "LO:HI[:STEP]".
+struct SweepRange {
+    int lo;
+    int hi;
+    int step;
+
+    int points() const { return (hi - lo) / step + 1; }
+    int at(int k) const { return lo + k * step; }
+
+    bool parse(const string& text) {
+        int values[3] = {0, 0, 1};
+        int count = 0;
+        stringstream in(text);
+        string part;
+        while (count < 3 && getline(in, part, ':')) {
+            char* end = nullptr;
+            values[count++] = static_cast<int>(strtol(part.c_str(), &end, 10));
+            if (part.empty() || *end != '\0') {
+                return false;
+            }
+        }
+        if (count < 2 || !in.eof() || values[2] < 1 || values[1] < values[0]) {
+            return false;
+        }
+        lo = values[0];
+        hi = values[1];
+        step = values[2];
+        return true;
+    }
+};
+
+struct BatchOptions {
+    int floors = 10;
+    int elevators = 2;
+    long long ticks = 1000;
+    string workload = "random";     // see printUsage()
+    string tracePath;
+    string odMatrixPath;
+    int period = 86400;             // length of one "day" workload cycle
+    double rate = 0.1;              // requests per tick
+    uint64_t seed = 1;
+    string logPath = "elevator_log.txt";
+    LogOptions log;
+    bool summary = true;
+    string bench;                   // benchmark to run instead of a simulation
+    string benchOut;                // --bench core: CSV results file
+    string baseline;                // --bench core: CSV to compare against
+    double regressThreshold = 15;   // percent slower than baseline to flag
+    string engine = "tick";         // tick | event
+    bool fastForward = true;        // tick engine: skip quiescent intervals
+    int replicas = 1;               // > 1 runs an ensemble (runEnsemble)
+    int threads = 0;                // ensemble worker threads; 0 = all cores
+    DispatchParams dispatch;
+    string sweep;                   // grid | random: run a parameter sweep
+    SweepRange penaltyRange{0, 20, 2};
+    SweepRange queueWeightRange{0, 4, 1};
+    int sweepPoints = 64;           // configurations drawn by a random sweep
+    vector<string> sweepWorkloads;  // defaults to {workload}
+    bool checkAlloc = false;        // count allocations in step() instead
+    StopOrder stopOrder = StopOrder::Fifo;
+    DispatchPolicy policy = DispatchPolicy::Heuristic;
+    bool batchAssign = false;       // --assign batch
+    int assignBudget = 1000;        // microseconds per batch solve
+    int reassignInterval = 0;       // --reassign: 0 = assignments are final
+    bool perfCounters = false;      // profiling builds: add hardware counters
+    int checkpointAt = -1;          // clock value to snapshot at ...
+    string checkpointOut;           // ... into this file
+    string restorePath;             // start from this snapshot instead of t=0
+    int whatIfAt = -1;              // fork into what-if scenarios at this clock ...
+    int whatIfHorizon = 600;        // ... and run each for this many ticks
+};
+
+void printUsage(const char* prog) {
+    cout << "Usage: " << prog << " [options]\n"
+         << "Without options the interactive console simulation starts.\n\n"
+         << "Batch options:\n"
+         << "  --floors N        number of floors (default 10)\n"
+         << "  --elevators N     number of elevators (default 2)\n"
+         << "  --ticks N         time steps to simulate (default 1000); 0 (--trace\n"
+         << "                    only) runs until the trace is exhausted and every\n"
+         << "                    car is idle\n"
+         << "  --workload KIND   random | uppeak | downpeak | lunch | interfloor | day\n"
+         << "                    | none (default random); 'day' cycles through the\n"
+         << "                    others at --rate peak load every --period ticks\n"
+         << "  --period N        length of the 'day' workload in ticks (default 86400)\n"
+         << "  --od-matrix FILE  generate traffic from a floors x floors weight matrix\n"
+         << "  --trace FILE      replay hall calls from FILE ('-' for stdin): lines of\n"
+         << "                    'timestamp from to [passengers]'\n"
+         << "  --rate R          generated workloads: requests per tick (default 0.1)\n"
+         << "  --seed S          generated workloads: seed (default 1)\n"
+         << "  --log PATH        log file, or 'none' (default elevator_log.txt)\n"
+         << "  --log-format F    text | binary (default text)\n"
+         << "  --log-delta K     log only state changes, plus a full keyframe\n"
+         << "                    every K ticks\n"
+         << "  --log-async N     write the log from a background thread through a\n"
+         << "                    ring of N records\n"
+         << "  --log-overflow P  block | drop when the ring is full (default block)\n"
+         << "  --convert-log IN OUT\n"
+         << "                    render a binary or delta log IN as a full text\n"
+         << "                    log OUT and exit\n"
+         << "  --engine KIND     tick | event (default tick); the event engine\n"
+         << "                    jumps between events and skips per-tick logging\n"
+         << "  --no-fast-forward tick engine: step and log every idle tick\n"
+         << "  --no-summary      skip the end-of-run summary\n"
+         << "  --check-alloc     allocation-counting builds (make CHECK_ALLOC=1): run\n"
+         << "                    the tick engine for --ticks, count heap allocations\n"
+         << "                    inside step() over the second half and fail unless\n"
+         << "                    there are none\n"
+         << "  --replicas N      run N independent replicas with seeds S .. S+N-1\n"
+         << "                    and report means with 95% confidence intervals;\n"
+         << "                    replica k logs to PATH with '.rk' before the\n"
+         << "                    extension\n"
+         << "  --threads K       ensemble and sweep worker threads (default: all\n"
+         << "                    cores)\n"
+         << "  --direction-penalty N\n"
+         << "                    dispatch score for a car heading away from the\n"
+         << "                    caller (default 5)\n"
+         << "  --queue-weight N  dispatch score per queued stop (default 1)\n"
+         << "  --stop-order O    fifo | scan (default fifo); scan keeps each car's\n"
+         << "                    stops as a floor set served in LOOK order\n"
+         << "  --policy P        dispatch policy: nearest | heuristic | collective\n"
+         << "                    | eta | destination (default heuristic);\n"
+         << "                    collective implies --stop-order scan\n"
+         << "  --assign MODE     greedy | batch (default greedy); batch matches each\n"
+         << "                    tick's requests to distinct cars at minimum total\n"
+         << "                    policy cost (Hungarian; auction for large, nearly\n"
+         << "                    square batches)\n"
+         << "  --assign-budget US\n"
+         << "                    time limit per batch solve before falling back to\n"
+         << "                    greedy (default 1000 microseconds)\n"
+         << "  --perf-counters   profiling builds (make PROFILE=1): add cycles,\n"
+         << "                    instructions, cache and branch misses per phase\n"
+         << "  --checkpoint-at T --checkpoint-out FILE\n"
+         << "                    save the full simulation state when the clock\n"
+         << "                    reaches T\n"
+         << "  --restore FILE    start from a saved snapshot; its floors, cars and\n"
+         << "                    dispatch settings replace the command line's, and\n"
+         << "                    workload requests up to its clock are skipped\n"
+         << "  --what-if T       run to T, fork the simulation into scenarios (as\n"
+         << "                    is, each car out of service, each other policy)\n"
+         << "                    and compare them over the same future requests\n"
+         << "  --what-if-horizon N\n"
+         << "                    ticks each what-if scenario runs (default 600)\n"
+         << "  --reassign N      keep hall calls revocable until pickup and move\n"
+         << "                    them to a clearly cheaper car every N ticks\n"
+         << "  --sweep MODE      grid | random: score every (penalty, queue weight)\n"
+         << "                    configuration on the same recorded workloads and\n"
+         << "                    print the mean wait / p99 wait Pareto front;\n"
+         << "                    workloads are --replicas seeds of each kind\n"
+         << "  --penalty-range LO:HI[:STEP]\n"
+         << "                    sweep range for the penalty (default 0:20:2)\n"
+         << "  --queue-weight-range LO:HI[:STEP]\n"
+         << "                    sweep range for the queue weight (default 0:4:1)\n"
+         << "  --sweep-points N  configurations drawn by a random sweep (default 64)\n"
+         << "  --sweep-workloads A,B,...\n"
+         << "                    workload kinds to sweep over (default --workload)\n"
+         << "  --bench NAME      run a benchmark: scaling, layout, kernel,\n"
+         << "                    generator, stops, policies, assign, core\n"
+         << "  --bench-out FILE  core benchmark: write results as CSV\n"
+         << "  --baseline FILE   core benchmark: compare with an earlier CSV and\n"
+         << "                    fail on regressions\n"
+         << "  --regress-threshold PCT\n"
+         << "                    ns/op increase over the baseline that counts as\n"
+         << "                    a regression (default 15)\n"
+         << "  --help            show this message\n";
+}
+
+bool parseDispatchPolicy(const string& name, DispatchPolicy& policy) {
+    static const pair<const char*, DispatchPolicy> names[] = {
+        {"nearest", DispatchPolicy::Nearest},
+        {"heuristic", DispatchPolicy::Heuristic},
+        {"collective", DispatchPolicy::Collective},
+        {"eta", DispatchPolicy::Eta},
+        {"destination", DispatchPolicy::Destination}};
+    for (const auto& entry : names) {
+        if (name == entry.first) {
+            policy = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses argv into opts. Returns false on a malformed command line.
+bool parseBatchOptions(int argc, char* argv[], BatchOptions& opts) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--no-summary") {
+            opts.summary = false;
+        } else if (arg == "--no-fast-forward") {
+            opts.fastForward = false;
+        } else if (arg == "--check-alloc") {
+#ifdef ELEVATOR_CHECK_ALLOC
+            opts.checkAlloc = true;
+#else
+            cerr << "--check-alloc needs an allocation-counting build (make CHECK_ALLOC=1).\n";
+            return false;
+#endif
+        } else if (arg == "--perf-counters") {
+#ifdef ELEVATOR_PROFILE
+            opts.perfCounters = true;
+#else
+            cerr << "--perf-counters needs a profiling build (make PROFILE=1).\n";
+            return false;
+#endif
+        } else if (!hasValue) {
+            cerr << "Missing value or unknown option: " << arg << "\n";
+            return false;
+        } else if (arg == "--floors") {
+            opts.floors = atoi(argv[++i]);
+        } else if (arg == "--elevators") {
+            opts.elevators = atoi(argv[++i]);
+        } else if (arg == "--ticks") {
+            opts.ticks = atoll(argv[++i]);
+        } else if (arg == "--workload") {
+            opts.workload = argv[++i];
+        } else if (arg == "--period") {
+            opts.period = atoi(argv[++i]);
+        } else if (arg == "--od-matrix") {
+            opts.workload = "matrix";
+            opts.odMatrixPath = argv[++i];
+        } else if (arg == "--trace") {
+            opts.workload = "trace";
+            opts.tracePath = argv[++i];
+        } else if (arg == "--rate") {
+            opts.rate = atof(argv[++i]);
+        } else if (arg == "--seed") {
+            opts.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--log-format") {
+            string fmt = argv[++i];
+            if (fmt == "text") {
+                opts.log.format = LogFormat::Text;
+            } else if (fmt == "binary") {
+                opts.log.format = LogFormat::Binary;
+            } else {
+                cerr << "Unknown log format: " << fmt << "\n";
+                return false;
+            }
+        } else if (arg == "--log-delta") {
+            opts.log.keyframeInterval = atoi(argv[++i]);
+        } else if (arg == "--log-async") {
+            opts.log.asyncRing = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--log-overflow") {
+            string policy = argv[++i];
+            if (policy == "block") {
+                opts.log.overflow = LogOverflow::Block;
+            } else if (policy == "drop") {
+                opts.log.overflow = LogOverflow::Drop;
+            } else {
+                cerr << "Unknown overflow policy: " << policy << "\n";
+                return false;
+            }
+        } else if (arg == "--engine") {
+            opts.engine = argv[++i];
+        } else if (arg == "--bench") {
+            opts.bench = argv[++i];
+        } else if (arg == "--bench-out") {
+            opts.benchOut = argv[++i];
+        } else if (arg == "--baseline") {
+            opts.baseline = argv[++i];
+        } else if (arg == "--regress-threshold") {
+            opts.regressThreshold = atof(argv[++i]);
+        } else if (arg == "--replicas") {
+            opts.replicas = atoi(argv[++i]);
+        } else if (arg == "--threads") {
+            opts.threads = atoi(argv[++i]);
+        } else if (arg == "--direction-penalty") {
+            opts.dispatch.directionPenalty = atoi(argv[++i]);
+        } else if (arg == "--queue-weight") {
+            opts.dispatch.queueWeight = atoi(argv[++i]);
+        } else if (arg == "--stop-order") {
+            string order = argv[++i];
+            if (order == "fifo") {
+                opts.stopOrder = StopOrder::Fifo;
+            } else if (order == "scan") {
+                opts.stopOrder = StopOrder::Scan;
+            } else {
+                cerr << "Unknown stop order: " << order << "\n";
+                return false;
+            }
+        } else if (arg == "--policy") {
+            if (!parseDispatchPolicy(argv[++i], opts.policy)) {
+                cerr << "Unknown dispatch policy: " << argv[i] << "\n";
+                return false;
+            }
+        } else if (arg == "--assign") {
+            string mode = argv[++i];
+            if (mode != "greedy" && mode != "batch") {
+                cerr << "Unknown assignment mode: " << mode << "\n";
+                return false;
+            }
+            opts.batchAssign = mode == "batch";
+        } else if (arg == "--assign-budget") {
+            opts.assignBudget = atoi(argv[++i]);
+        } else if (arg == "--checkpoint-at") {
+            opts.checkpointAt = atoi(argv[++i]);
+        } else if (arg == "--checkpoint-out") {
+            opts.checkpointOut = argv[++i];
+        } else if (arg == "--restore") {
+            opts.restorePath = argv[++i];
+        } else if (arg == "--what-if") {
+            opts.whatIfAt = atoi(argv[++i]);
+        } else if (arg == "--what-if-horizon") {
+            opts.whatIfHorizon = atoi(argv[++i]);
+        } else if (arg == "--reassign") {
+            opts.reassignInterval = atoi(argv[++i]);
+        } else if (arg == "--sweep") {
+            opts.sweep = argv[++i];
+        } else if (arg == "--sweep-points") {
+            opts.sweepPoints = atoi(argv[++i]);
+        } else if (arg == "--penalty-range" || arg == "--queue-weight-range") {
+            SweepRange& range = arg == "--penalty-range" ? opts.penaltyRange
+                                                         : opts.queueWeightRange;
+            if (!range.parse(argv[++i])) {
+                cerr << "Bad range for " << arg << ": " << argv[i] << "\n";
+                return false;
+            }
+        } else if (arg == "--sweep-workloads") {
+            stringstream list(argv[++i]);
+            string kind;
+            while (getline(list, kind, ',')) {
+                opts.sweepWorkloads.push_back(kind);
+            }
+        } else if (arg == "--log") {
+            opts.logPath = argv[++i];
+            if (opts.logPath == "none") {
+                opts.logPath.clear();
+            }
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+
+    if (opts.floors < 2 || opts.floors > MAX_FLOORS ||
+        opts.elevators < 1 || opts.elevators > MAX_ELEVATORS || opts.ticks < 0) {
+        cerr << "Floors must be 2 - " << MAX_FLOORS << ", elevators 1 - "
+             << MAX_ELEVATORS << " and ticks non-negative.\n";
+        return false;
+    }
+    if (!opts.bench.empty() && opts.bench != "scaling" && opts.bench != "layout" &&
+        opts.bench != "kernel" && opts.bench != "generator" && opts.bench != "stops" &&
+        opts.bench != "policies" && opts.bench != "assign" && opts.bench != "core") {
+        cerr << "Unknown benchmark: " << opts.bench << "\n";
+        return false;
+    }
+    if (opts.engine != "tick" && opts.engine != "event") {
+        cerr << "Unknown engine: " << opts.engine << "\n";
+        return false;
+    }
+    if (opts.ticks > numeric_limits<int>::max()) {
+        cerr << "Too many ticks.\n";
+        return false;
+    }
+    if (opts.policy == DispatchPolicy::Collective) {
+        opts.stopOrder = StopOrder::Scan;
+    }
+    if (opts.checkAlloc && opts.ticks < 2) {
+        cerr << "--check-alloc needs --ticks of at least 2.\n";
+        return false;
+    }
+    if (opts.replicas < 1 || opts.threads < 0) {
+        cerr << "Replicas must be positive and threads non-negative.\n";
+        return false;
+    }
+    if (opts.checkpointOut.empty() != (opts.checkpointAt < 0)) {
+        cerr << "--checkpoint-at T and --checkpoint-out FILE go together.\n";
+        return false;
+    }
+    if ((!opts.checkpointOut.empty() || !opts.restorePath.empty()) &&
+        (opts.replicas > 1 || !opts.sweep.empty() || opts.checkAlloc)) {
+        cerr << "Checkpoints are for single runs, not ensembles, sweeps or --check-alloc.\n";
+        return false;
+    }
+    if (opts.whatIfAt >= 0) {
+        if (opts.whatIfHorizon < 1 ||
+            opts.whatIfAt > numeric_limits<int>::max() - opts.whatIfHorizon) {
+            cerr << "--what-if-horizon must be positive and end within the clock range.\n";
+            return false;
+        }
+        if (opts.replicas > 1 || !opts.sweep.empty() || opts.checkAlloc ||
+            !opts.checkpointOut.empty()) {
+            cerr << "--what-if forks a single run; it cannot be combined with ensembles,\n"
+                 << "sweeps, --check-alloc or checkpoints.\n";
+            return false;
+        }
+    }
+    if (opts.threads == 0) {
+        opts.threads = max(1u, thread::hardware_concurrency());
+    }
+    if (!opts.sweep.empty()) {
+        if (opts.sweep != "grid" && opts.sweep != "random") {
+            cerr << "Unknown sweep: " << opts.sweep << "\n";
+            return false;
+        }
+        if (opts.sweepPoints < 1) {
+            cerr << "--sweep-points must be positive.\n";
+            return false;
+        }
+        if (opts.sweepWorkloads.empty()) {
+            opts.sweepWorkloads.push_back(opts.workload);
+        }
+    }
+    static const char* const workloads[] = {
+        "random", "uppeak", "downpeak", "lunch", "interfloor", "day", "matrix", "trace", "none"};
+    vector<string> kinds = opts.sweep.empty() ? vector<string>{opts.workload}
+                                              : opts.sweepWorkloads;
+    for (const string& kind : kinds) {
+        if (find(begin(workloads), end(workloads), kind) == end(workloads)) {
+            cerr << "Unknown workload: " << kind << "\n";
+            return false;
+        }
+        if (kind == "trace" && opts.tracePath.empty()) {
+            cerr << "Use --trace FILE to replay a trace.\n";
+            return false;
+        }
+        if (kind == "trace" && opts.replicas > 1) {
+            cerr << "Every replica of a trace is identical; --replicas needs a generated workload.\n";
+            return false;
+        }
+        // Only a trace runs out; any other workload would never end. Benchmarks
+        // and what-if runs set their own length.
+        if (opts.ticks == 0 && kind != "trace" && opts.bench.empty() && opts.whatIfAt < 0) {
+            cerr << "--ticks 0 runs until a trace is exhausted; workload '" << kind
+                 << "' needs --ticks > 0.\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Builds the workload named by opts.workload, or null (with a message) if
+// its input cannot be read.
+unique_ptr<WorkloadSource> makeWorkload(const BatchOptions& opts, uint64_t seed) {
+    const int floors = opts.floors;
+    const string& kind = opts.workload;
+
+    if (kind == "trace") {
+        unique_ptr<TraceWorkload> trace(new TraceWorkload(opts.tracePath));
+        if (!trace->isOpen()) {
+            cerr << "Cannot read trace " << opts.tracePath << "\n";
+            return nullptr;
+        }
+        return unique_ptr<WorkloadSource>(trace.release());
+    }
+    if (kind == "random" || kind == "none") {
+        double rate = kind == "none" ? 0.0 : opts.rate;
+        return unique_ptr<WorkloadSource>(new RandomWorkload(floors, rate, seed));
+    }
+    if (kind == "day") {
+        return unique_ptr<WorkloadSource>(new GeneratedWorkload(
+            makeOfficeDay(floors, opts.rate, max(1, opts.period), seed)));
+    }
+
+    TrafficPattern pattern;
+    if (kind == "uppeak") {
+        pattern = TrafficPattern::upPeak(floors);
+    } else if (kind == "downpeak") {
+        pattern = TrafficPattern::downPeak(floors);
+    } else if (kind == "lunch") {
+        pattern = TrafficPattern::lunch(floors);
+    } else if (kind == "matrix") {
+        vector<double> weights;
+        if (!loadOdMatrix(opts.odMatrixPath, floors, weights)) {
+            return nullptr;
+        }
+        pattern = TrafficPattern::fromMatrix(floors, weights);
+    } else {
+        pattern = TrafficPattern::interfloor(floors);
+    }
+    return unique_ptr<WorkloadSource>(new GeneratedWorkload(
+        TrafficGenerator(pattern, opts.rate, seed)));
+}
+
+// Applies the command-line settings that every batch-style run shares.
+void configureSystem(ElevatorSystem& sys, const BatchOptions& opts) {
+    sys.setVerbose(false);
+    sys.setDispatchParams(opts.dispatch);
+    sys.setStopOrder(opts.stopOrder);
+    sys.setDispatchPolicy(opts.policy);
+    // Ensembles, sweeps and what-if scenarios already keep every core busy
+    int solverThreads = opts.replicas > 1 || !opts.sweep.empty() || opts.whatIfAt >= 0
+                            ? 1 : opts.threads;
+    sys.setBatchAssignment(opts.batchAssign, opts.assignBudget, solverThreads);
+    sys.setReassignInterval(opts.reassignInterval);
+#ifdef ELEVATOR_PROFILE
+    if (opts.perfCounters) {
+        sys.enableHardwareCounters();
+    }
+#endif
+}
+
+struct DriveCounts {
+    long long injected = 0;
+    long long rejected = 0;
+};
+
+void writeCheckpoint(const ElevatorSystem& sys, const BatchOptions& opts) {
+    auto start = chrono::steady_clock::now();
+    size_t bytes = sys.saveSnapshot(opts.checkpointOut);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (bytes == 0) {
+        cerr << "Could not write checkpoint " << opts.checkpointOut << "\n";
+    } else if (opts.summary) {
+        cout << "Checkpoint at t=" << sys.getCurrentTime() << " saved to " << opts.checkpointOut
+             << " (" << bytes << " bytes, " << ms << " ms)\n";
+    }
+}
+
+// Feeds `workload` into `sys` for opts.ticks ticks (0, for a trace: until
+// the trace is exhausted and every car is idle) with the engine named by opts.
+DriveCounts driveSimulation(ElevatorSystem& sys, WorkloadSource& workload,
+                            const BatchOptions& opts) {
+    DriveCounts counts;
+    const bool untilDone = opts.ticks == 0;
+    const int endTime = untilDone ? numeric_limits<int>::max() : static_cast<int>(opts.ticks);
+    int checkpointAt = opts.checkpointOut.empty() ? -1 : opts.checkpointAt;
+    // A checkpoint at endTime still gets that tick's requests queued
+    while (sys.getCurrentTime() < endTime || sys.getCurrentTime() == checkpointAt) {
+        while (workload.nextTime() <= sys.getCurrentTime()) {
+            Request r = workload.next();
+            if (sys.addRequest(r.fromFloor, r.toFloor, r.passengers)) {
+                ++counts.injected;
+            } else {
+                ++counts.rejected;
+            }
+        }
+
+        // After this tick's requests are queued, so that a restored run
+        // continues with the requests stamped later
+        if (sys.getCurrentTime() == checkpointAt) {
+            writeCheckpoint(sys, opts);
+            checkpointAt = -1;
+            if (sys.getCurrentTime() >= endTime) {
+                break;
+            }
+        }
+
+        int next = workload.nextTime();
+        bool exhausted = next == WorkloadSource::NO_MORE_REQUESTS;
+        if (untilDone && exhausted && sys.isQuiescent() && checkpointAt < 0) {
+            break;
+        }
+
+        // Jumps stop at the checkpoint as they stop at requests
+        int stopAt = min(next, endTime);
+        if (checkpointAt > sys.getCurrentTime()) {
+            stopAt = min(stopAt, checkpointAt);
+        }
+        if (opts.engine == "event") {
+            if (untilDone && exhausted && checkpointAt < 0) {
+                sys.advanceUntilQuiescent();
+            } else {
+                sys.advanceTo(stopAt);
+            }
+        } else if (!opts.fastForward || !sys.fastForwardTo(stopAt)) {
+            sys.step();
+        }
+    }
+    if (checkpointAt >= 0) {
+        cerr << "The run ended at t=" << sys.getCurrentTime() << ", before the checkpoint at t="
+             << checkpointAt << "; nothing saved.\n";
+    }
+    return counts;
+}
+
+// The system and workload of a single run: fresh at t=0, or resumed from
+// opts.restorePath, whose building then replaces the one in opts and whose
+// already queued requests are skipped. Null, after a message, on failure.
+unique_ptr<ElevatorSystem> startSystem(BatchOptions& opts, unique_ptr<WorkloadSource>& workload) {
+    SnapshotReader snapshot;
+    string error;
+    if (!opts.restorePath.empty()) {
+        // The building comes from the snapshot, for the workload too
+        if (!snapshot.open(opts.restorePath, error) ||
+            !snapshotDimensions(snapshot, opts.floors, opts.elevators)) {
+            cerr << "Cannot restore: " << (error.empty() ? "no system section" : error) << "\n";
+            return nullptr;
+        }
+        if (opts.floors < 2 || opts.floors > MAX_FLOORS ||
+            opts.elevators < 1 || opts.elevators > MAX_ELEVATORS) {
+            cerr << "Cannot restore: snapshot has an invalid building size\n";
+            return nullptr;
+        }
+    }
+
+    unique_ptr<ElevatorSystem> sys(
+        new ElevatorSystem(opts.floors, opts.elevators, opts.logPath, opts.log));
+    configureSystem(*sys, opts);
+
+    workload = makeWorkload(opts, opts.seed);
+    if (!workload) {
+        return nullptr;
+    }
+
+    if (!opts.restorePath.empty()) {
+        auto start = chrono::steady_clock::now();
+        if (!sys->restoreSnapshot(snapshot, error)) {
+            cerr << "Cannot restore: " << error << "\n";
+            return nullptr;
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        // Those were already queued when the snapshot was taken
+        while (workload->nextTime() <= sys->getCurrentTime()) {
+            workload->next();
+        }
+        if (opts.summary) {
+            cout << "Restored " << opts.restorePath << " at t=" << sys->getCurrentTime()
+                 << " (" << ms << " ms)\n";
+        }
+    }
+    return sys;
+}
+
+// Runs the simulation in a tight loop: no per-tick console output.
+int runBatch(BatchOptions opts) {
+    unique_ptr<WorkloadSource> workload;
+    unique_ptr<ElevatorSystem> started = startSystem(opts, workload);
+    if (!started) {
+        return 1;
+    }
+    ElevatorSystem& sys = *started;
+    const TraceWorkload* trace = dynamic_cast<const TraceWorkload*>(workload.get());
+
+    auto start = chrono::steady_clock::now();
+    DriveCounts counts = driveSimulation(sys, *workload, opts);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (opts.summary) {
+        sys.printSummary();
+        cout << "Requests injected: " << counts.injected
+             << " (" << counts.rejected << " rejected)\n";
+        if (trace) {
+            cout << "Trace lines malformed: " << trace->getMalformed()
+                 << ", out of order: " << trace->getOutOfOrder() << "\n";
+        }
+        const SimLog& log = sys.getLog();
+        if (log.isAsync()) {
+            cout << "Log ring: " << log.getDropped() << " records dropped, high-water mark "
+                 << log.getHighWater() << " / " << log.getRingCapacity() << "\n";
+        }
+        cout << "Wall time: " << seconds << " s ("
+             << (seconds > 0 ? sys.getCurrentTime() / seconds : 0.0) << " ticks/s)\n";
+    }
+    return 0;
+}
+
+#ifdef ELEVATOR_CHECK_ALLOC
+
+/*
+   Allocation self-check: drives the tick engine for opts.ticks ticks,
+   using the first half as warm-up (stop queues and the log reach their
+   working size) and counting heap allocations made inside step() during
+   the second half. Requests are injected outside the counted region,
+   where addRequest() also reserves their rider slots. Returns non-zero
+   if step() allocated.
+*/
+int runAllocationCheck(const BatchOptions& opts) {
+    ElevatorSystem sys(opts.floors, opts.elevators, opts.logPath, opts.log);
+    configureSystem(sys, opts);
+
+    unique_ptr<WorkloadSource> workload = makeWorkload(opts, opts.seed);
+    if (!workload) {
+        return 1;
+    }
+
+    const int endTime = static_cast<int>(opts.ticks);
+    const int warmUp = endTime / 2;
+    uint64_t allocations = 0;
+    while (sys.getCurrentTime() < endTime) {
+        while (workload->nextTime() <= sys.getCurrentTime()) {
+            Request r = workload->next();
+            sys.addRequest(r.fromFloor, r.toFloor, r.passengers);
+        }
+        uint64_t before = threadAllocations;
+        sys.step();
+        if (sys.getCurrentTime() > warmUp) {
+            allocations += threadAllocations - before;
+        }
+    }
+
+    cout << "step() allocations after a " << warmUp << "-tick warm-up: " << allocations
+         << " in " << endTime - warmUp << " ticks"
+         << (allocations == 0 ? " (OK)" : " (FAIL)") << "\n";
+    return allocations == 0 ? 0 : 1;
+}
+
+#endif
+
+// ================== Ensemble ==================
+
+// "log.txt" -> "log.r3.txt": one log file per replica.
+string replicaLogPath(const string& path, size_t replica) {
+    if (path.empty()) {
+        return path;
+    }
+    string tag = ".r" + to_string(replica);
+    size_t slash = path.find_last_of('/');
+    size_t nameStart = slash == string::npos ? 0 : slash + 1;
+    size_t dot = path.find_last_of('.');
+    if (dot == string::npos || dot <= nameStart) {
+        return path + tag;
+    }
+    return path.substr(0, dot) + tag + path.substr(dot);
+}
+
+// Two-sided 95% Student t quantile; 1.96 + 2.4/df is within 0.1% past 30.
+double tQuantile95(size_t df) {
+    static const double table[] = {
+        0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df < sizeof(table) / sizeof(table[0])) {
+        return table[df];
+    }
+    return 1.96 + 2.4 / static_cast<double>(df);
+}
+
+// Prints the mean of one metric over the replicas with its 95% confidence
+// interval (replicas are independent, so the t interval applies).
+void printInterval(const char* label, const vector<double>& values) {
+    size_t n = values.size();
+    double mean = 0.0;
+    for (double v : values) {
+        mean += v;
+    }
+    mean /= static_cast<double>(n);
+
+    double squares = 0.0;
+    for (double v : values) {
+        squares += (v - mean) * (v - mean);
+    }
+    streamsize oldPrecision = cout.precision();
+    cout << "  " << left << setw(20) << label << right << fixed << setprecision(3) << mean;
+    if (n > 1) {
+        double halfWidth = tQuantile95(n - 1) * sqrt(squares / (n - 1) / n);
+        cout << " +/- " << halfWidth;
+    }
+    cout << "\n";
+    cout.unsetf(ios::fixed);
+    cout.precision(oldPrecision);
+}
+
+struct ReplicaResult {
+    uint64_t seed = 0;
+    int ticks = 0;
+    long long injected = 0;
+    long long stops = 0;
+    LatencyHistogram waits;
+    LatencyHistogram rides;
+};
+
+/*
+   Runs opts.replicas independent copies of the batch simulation on
+   opts.threads threads. Replica k draws its workload from seed + k and
+   logs to its own file (see replicaLogPath), so replicas share nothing
+   but the read-only options and throughput scales with the core count.
+   Per-replica metrics are reported as mean +/- 95% CI; the wait and ride
+   histograms are also merged into one pooled distribution.
+*/
+int runEnsemble(const BatchOptions& opts) {
+    const size_t replicas = static_cast<size_t>(opts.replicas);
+
+    // Built up front so bad inputs fail once, before any thread starts.
+    vector<unique_ptr<WorkloadSource>> workloads(replicas);
+    for (size_t k = 0; k < replicas; ++k) {
+        workloads[k] = makeWorkload(opts, opts.seed + k);
+        if (!workloads[k]) {
+            return 1;
+        }
+    }
+
+    vector<ReplicaResult> results(replicas);
+    auto start = chrono::steady_clock::now();
+    parallelFor(replicas, opts.threads, [&](size_t k) {
+        ElevatorSystem sys(opts.floors, opts.elevators,
+                           replicaLogPath(opts.logPath, k), opts.log);
+        configureSystem(sys, opts);
+        DriveCounts counts = driveSimulation(sys, *workloads[k], opts);
+        workloads[k].reset();
+
+        ReplicaResult& r = results[k];
+        r.seed = opts.seed + k;
+        r.ticks = sys.getCurrentTime();
+        r.injected = counts.injected;
+        r.stops = sys.getTotalStopsServed();
+        r.waits = sys.getTrips().getWaitTimes();
+        r.rides = sys.getTrips().getRideTimes();
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (!opts.summary) {
+        return 0;
+    }
+
+    LatencyHistogram waits;
+    LatencyHistogram rides;
+    vector<double> meanWait, p99Wait, meanRide, p99Ride, stopsPerTick;
+    long long totalTicks = 0;
+    for (const ReplicaResult& r : results) {
+        waits.merge(r.waits);
+        rides.merge(r.rides);
+        meanWait.push_back(r.waits.mean());
+        p99Wait.push_back(static_cast<double>(r.waits.percentile(0.99)));
+        meanRide.push_back(r.rides.mean());
+        p99Ride.push_back(static_cast<double>(r.rides.percentile(0.99)));
+        stopsPerTick.push_back(r.ticks ? static_cast<double>(r.stops) / r.ticks : 0.0);
+        totalTicks += r.ticks;
+    }
+
+    cout << "\n===== Ensemble Summary =====\n";
+    cout << replicas << " replicas on " << min(replicas, static_cast<size_t>(opts.threads))
+         << " threads, seeds " << opts.seed << " - " << opts.seed + replicas - 1 << "\n";
+    if (replicas <= 20) {
+        for (size_t k = 0; k < replicas; ++k) {
+            const ReplicaResult& r = results[k];
+            cout << "Replica " << k << " (seed " << r.seed << "): " << r.ticks << " ticks, "
+                 << r.injected << " requests, mean wait " << r.waits.mean()
+                 << ", p99 wait " << r.waits.percentile(0.99) << "\n";
+        }
+    }
+    cout << "Per-replica mean +/- 95% CI:\n";
+    printInterval("Mean wait", meanWait);
+    printInterval("p99 wait", p99Wait);
+    printInterval("Mean ride", meanRide);
+    printInterval("p99 ride", p99Ride);
+    printInterval("Stops per tick", stopsPerTick);
+    cout << "Pooled over all replicas:\n";
+    waits.print("Wait time", "ticks");
+    rides.print("Ride time", "ticks");
+    cout << "Wall time: " << seconds << " s ("
+         << (seconds > 0 ? totalTicks / seconds : 0.0) << " ticks/s)\n";
+    return 0;
+}
+
+// ================== Parameter sweep ==================
+
+struct SweepPoint {
+    DispatchParams params;
+    LatencyHistogram waits;   // pooled over every sweep workload
+    bool onFront = false;
+};
+
+// Every configuration of a grid sweep, or sweepPoints distinct ones drawn
+// uniformly from the same grid for a random sweep.
+vector<DispatchParams> sweepConfigurations(const BatchOptions& opts) {
+    const SweepRange& pr = opts.penaltyRange;
+    const SweepRange& qr = opts.queueWeightRange;
+    vector<pair<int, int>> cells;
+    if (opts.sweep == "grid") {
+        for (int a = 0; a < pr.points(); ++a) {
+            for (int b = 0; b < qr.points(); ++b) {
+                cells.push_back(make_pair(a, b));
+            }
+        }
+    } else {
+        mt19937_64 rng(opts.seed);
+        uniform_int_distribution<int> pickPenalty(0, pr.points() - 1);
+        uniform_int_distribution<int> pickWeight(0, qr.points() - 1);
+        long long gridSize = static_cast<long long>(pr.points()) * qr.points();
+        size_t wanted = static_cast<size_t>(min<long long>(opts.sweepPoints, gridSize));
+        while (cells.size() < wanted) {
+            pair<int, int> cell(pickPenalty(rng), pickWeight(rng));
+            if (find(cells.begin(), cells.end(), cell) == cells.end()) {
+                cells.push_back(cell);
+            }
+        }
+        sort(cells.begin(), cells.end());
+    }
+
+    vector<DispatchParams> configs;
+    for (const pair<int, int>& cell : cells) {
+        DispatchParams p;
+        p.directionPenalty = pr.at(cell.first);
+        p.queueWeight = qr.at(cell.second);
+        configs.push_back(p);
+    }
+    return configs;
+}
+
+// Flags the points no other point beats on both mean and p99 wait.
+void markParetoFront(vector<SweepPoint>& points) {
+    vector<size_t> order(points.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    auto key = [&](size_t i) {
+        return make_pair(points[i].waits.mean(), points[i].waits.percentile(0.99));
+    };
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return key(a) < key(b); });
+
+    // In (mean, p99) order a point is on the front iff its p99 beats every
+    // earlier point's, or it ties the last front point exactly.
+    bool haveFront = false;
+    pair<double, uint64_t> last;
+    for (size_t i : order) {
+        pair<double, uint64_t> k = key(i);
+        if (!haveFront || k.second < last.second || k == last) {
+            points[i].onFront = true;
+            haveFront = true;
+            last = k;
+        }
+    }
+}
+
+/*
+   Scores every dispatch configuration against the same set of workloads:
+   opts.replicas seeds of each kind in opts.sweepWorkloads. Workloads are
+   generated once, up front, into shared read-only vectors and replayed
+   through RecordedWorkload, so a configuration costs only its simulations.
+   Every (configuration, workload) pair is one job on the thread pool;
+   logging is off for all of them.
+*/
+int runSweep(const BatchOptions& opts) {
+    const int until = opts.ticks == 0 ? WorkloadSource::NO_MORE_REQUESTS
+                                      : static_cast<int>(opts.ticks);
+    const size_t seeds = static_cast<size_t>(opts.replicas);
+    const size_t numWorkloads = opts.sweepWorkloads.size() * seeds;
+
+    auto start = chrono::steady_clock::now();
+    vector<vector<Request>> recorded(numWorkloads);
+    vector<char> recordedOk(numWorkloads, 0);
+    parallelFor(numWorkloads, opts.threads, [&](size_t w) {
+        BatchOptions kindOpts = opts;
+        kindOpts.workload = opts.sweepWorkloads[w / seeds];
+        unique_ptr<WorkloadSource> source = makeWorkload(kindOpts, opts.seed + w % seeds);
+        if (source) {
+            recorded[w] = recordWorkload(*source, until);
+            recordedOk[w] = 1;
+        }
+    });
+    if (find(recordedOk.begin(), recordedOk.end(), 0) != recordedOk.end()) {
+        return 1;
+    }
+    size_t totalRequests = 0;
+    for (const vector<Request>& r : recorded) {
+        totalRequests += r.size();
+    }
+    double recordSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<DispatchParams> configs = sweepConfigurations(opts);
+    vector<SweepPoint> points(configs.size());
+    vector<mutex> pointLocks(configs.size());
+    for (size_t c = 0; c < configs.size(); ++c) {
+        points[c].params = configs[c];
+    }
 
-enum class Direction {
-    Idle,
-    Up,
-    Down
-};
+    start = chrono::steady_clock::now();
+    parallelFor(configs.size() * numWorkloads, opts.threads, [&](size_t job) {
+        size_t c = job / numWorkloads;
+        RecordedWorkload workload(recorded[job % numWorkloads]);
+        ElevatorSystem sys(opts.floors, opts.elevators, "");
+        configureSystem(sys, opts);
+        sys.setDispatchParams(configs[c]);
+        driveSimulation(sys, workload, opts);
 
-string directionToString(Direction d) {
-    switch (d) {
-        case Direction::Idle: return "Idle";
-        case Direction::Up:   return "Up";
-        case Direction::Down: return "Down";
+        lock_guard<mutex> guard(pointLocks[c]);
+        points[c].waits.merge(sys.getTrips().getWaitTimes());
+    });
+    double sweepSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    markParetoFront(points);
+    if (!opts.summary) {
+        return 0;
     }
-    return "Unknown";
+
+    cout << "\n===== Parameter Sweep (" << opts.sweep << ") =====\n";
+    cout << configs.size() << " configurations x " << numWorkloads << " workloads on "
+         << opts.threads << " threads\n";
+    cout << "Workloads recorded once: " << totalRequests << " requests in "
+         << recordSeconds << " s\n";
+    cout << "Simulations: " << sweepSeconds << " s\n\n";
+
+    streamsize oldPrecision = cout.precision();
+    cout << fixed << setprecision(2);
+    cout << setw(8) << "penalty" << setw(8) << "queue" << setw(12) << "mean wait"
+         << setw(10) << "p99 wait" << "  front\n";
+    for (const SweepPoint& p : points) {
+        if (points.size() > 100 && !p.onFront) {
+            continue;   // large sweeps: front only
+        }
+        cout << setw(8) << p.params.directionPenalty << setw(8) << p.params.queueWeight
+             << setw(12) << p.waits.mean() << setw(10) << p.waits.percentile(0.99)
+             << (p.onFront ? "  *" : "") << "\n";
+    }
+    cout.unsetf(ios::fixed);
+    cout.precision(oldPrecision);
+    return 0;
 }
 
-// ================== Request ==================
+// ================== What-if scenarios ==================
 
-class Request {
-public:
-    int fromFloor;
-    int toFloor;
-    int timeRequested;
+// One alternative to try from the fork point: carOut >= 0 takes that car
+// out of service for the whole horizon, and policy dispatches.
+struct WhatIfScenario {
+    string name;
+    int carOut = -1;
+    DispatchPolicy policy = DispatchPolicy::Heuristic;
+    StopOrder stopOrder = StopOrder::Fifo;
+};
 
-    Request(int from, int to, int t)
-        : fromFloor(from), toFloor(to), timeRequested(t) {}
+struct WhatIfResult {
+    double forkMicros = 0;
+    LatencyHistogram waits;     // pickups within the horizon
+    LatencyHistogram rides;     // drop-offs within the horizon
+    long long inFlight = 0;     // riders not delivered at the horizon
+    long long floors = 0;       // floors traveled within the horizon
 };
 
-// ================== Elevator ==================
+// The system as it runs, each car out of service, then each other policy.
+vector<WhatIfScenario> whatIfScenarios(const ElevatorSystem& sys, int elevators) {
+    static const char* const policies[] = {
+        "nearest", "heuristic", "collective", "eta", "destination"};
+    WhatIfScenario asIs;
+    asIs.name = "as is";
+    asIs.policy = sys.getDispatchPolicy();
+    asIs.stopOrder = sys.getStopOrder();
 
-class Elevator {
-private:
-    int id;
-    int currentFloor;
-    Direction direction;
-    bool doorOpen;
-    deque<int> targets;      // floors to visit (queue)
-    int totalStopsServed;
+    vector<WhatIfScenario> scenarios(1, asIs);
+    for (int car = 0; car < elevators; ++car) {
+        WhatIfScenario s = asIs;
+        s.name = "car " + to_string(car) + " out";
+        s.carOut = car;
+        scenarios.push_back(s);
+    }
+    for (const char* name : policies) {
+        WhatIfScenario s = asIs;
+        parseDispatchPolicy(name, s.policy);
+        if (s.policy != asIs.policy) {
+            // As on the command line, collective control needs SCAN stops
+            if (s.policy == DispatchPolicy::Collective) {
+                s.stopOrder = StopOrder::Scan;
+            }
+            s.name = string("policy ") + name;
+            scenarios.push_back(s);
+        }
+    }
+    return scenarios;
+}
 
-public:
-    Elevator(int id_, int startFloor = 0)
-        : id(id_), currentFloor(startFloor),
-          direction(Direction::Idle), doorOpen(false),
-          totalStopsServed(0) {}
+/*
+   Runs the simulation to opts.whatIfAt (from t=0, or from a restored
+   snapshot), records the workload's requests for the next whatIfHorizon
+   ticks once, then forks one child per scenario to replay them on
+   opts.threads threads. Every child starts from the same state and sees
+   the same requests, so the rows differ only in the scenario. A fork
+   shares the parent's stop queues and rider lists copy-on-write (see
+   ElevatorSystem::fork), which keeps it far cheaper than building the
+   system again; the statistics of each row cover the horizon alone.
+*/
+int runWhatIf(BatchOptions opts) {
+    unique_ptr<WorkloadSource> workload;
+    unique_ptr<ElevatorSystem> parent = startSystem(opts, workload);
+    if (!parent) {
+        return 1;
+    }
+    if (opts.whatIfAt < parent->getCurrentTime()) {
+        cerr << "--what-if " << opts.whatIfAt << " is before the restored clock (t="
+             << parent->getCurrentTime() << ").\n";
+        return 1;
+    }
 
-    int getId() const { return id; }
-    int getCurrentFloor() const { return currentFloor; }
-    Direction getDirection() const { return direction; }
-    bool isDoorOpen() const { return doorOpen; }
-    int getQueueSize() const { return static_cast<int>(targets.size()); }
-    int getTotalStopsServed() const { return totalStopsServed; }
-
-    void addTarget(int floor) {
-        if (!targets.empty() && targets.back() == floor) {
-            return; // avoid duplicate consecutive target
+    auto start = chrono::steady_clock::now();
+    if (opts.whatIfAt > parent->getCurrentTime()) {
+        BatchOptions lead = opts;
+        lead.ticks = opts.whatIfAt;
+        driveSimulation(*parent, *workload, lead);
+    }
+    const int end = opts.whatIfAt + opts.whatIfHorizon;
+    const vector<Request> future = recordWorkload(*workload, end);
+    double leadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const long long floorsBefore = parent->getFloorsTraveled();
+    const vector<WhatIfScenario> scenarios = whatIfScenarios(*parent, opts.elevators);
+    vector<WhatIfResult> results(scenarios.size());
+    BatchOptions run = opts;
+    run.ticks = end;
+
+    start = chrono::steady_clock::now();
+    parallelFor(scenarios.size(), opts.threads, [&](size_t k) {
+        const WhatIfScenario& scenario = scenarios[k];
+        WhatIfResult& r = results[k];
+        auto forkStart = chrono::steady_clock::now();
+        unique_ptr<ElevatorSystem> child = parent->fork();
+        r.forkMicros = chrono::duration<double, micro>(chrono::steady_clock::now() -
+                                                       forkStart).count();
+
+        child->clearTripStatistics();
+        child->setStopOrder(scenario.stopOrder);
+        child->setDispatchPolicy(scenario.policy);
+        if (scenario.carOut >= 0) {
+            child->setInService(scenario.carOut, false);
         }
-        targets.push_back(floor);
+        RecordedWorkload replay(future);
+        driveSimulation(*child, replay, run);
+
+        r.waits = child->getTrips().getWaitTimes();
+        r.rides = child->getTrips().getRideTimes();
+        r.inFlight = child->getTrips().getInFlight();
+        r.floors = child->getFloorsTraveled() - floorsBefore;
+    });
+    double runSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (!opts.summary) {
+        return 0;
     }
 
-    bool isIdle() const {
-        return targets.empty() && !doorOpen && direction == Direction::Idle;
+    double forkMicros = 0;
+    for (const WhatIfResult& r : results) {
+        forkMicros += r.forkMicros;
     }
+    forkMicros /= results.size();
 
-    int distanceToFloor(int floor) const {
-        return abs(floor - currentFloor);
+    cout << "\n===== What-if at t=" << opts.whatIfAt << ", next " << opts.whatIfHorizon
+         << " ticks =====\n";
+    cout << scenarios.size() << " scenarios on "
+         << min(scenarios.size(), static_cast<size_t>(opts.threads)) << " threads, "
+         << future.size() << " future requests recorded once\n";
+    cout << "Run to fork point: " << leadSeconds << " s; fork: " << forkMicros
+         << " us per scenario; scenarios: " << runSeconds << " s\n\n";
+
+    streamsize oldPrecision = cout.precision();
+    cout << fixed << setprecision(2);
+    cout << left << setw(20) << "scenario" << right << setw(11) << "mean wait"
+         << setw(10) << "p99 wait" << setw(10) << "vs as is" << setw(11) << "mean ride"
+         << setw(11) << "delivered" << setw(11) << "in flight" << setw(9) << "floors" << "\n";
+    const double baseWait = results[0].waits.mean();
+    for (size_t k = 0; k < scenarios.size(); ++k) {
+        const WhatIfResult& r = results[k];
+        cout << left << setw(20) << scenarios[k].name << right
+             << setw(11) << r.waits.mean() << setw(10) << r.waits.percentile(0.99)
+             << setw(10) << showpos << r.waits.mean() - baseWait << noshowpos
+             << setw(11) << r.rides.mean() << setw(11) << r.rides.count()
+             << setw(11) << r.inFlight << setw(9) << r.floors << "\n";
     }
+    cout.unsetf(ios::fixed);
+    cout.precision(oldPrecision);
+    return 0;
+}
+
+// ================== Benchmarks ==================
+
+// Ticks per second for one configuration, logging disabled. The random
+// workload scales with the fleet so every car has something to do.
+double measureTicksPerSecond(int floors, int numElevators, long long ticks, uint64_t seed) {
+    ElevatorSystem sys(floors, numElevators, "");
+    sys.setVerbose(false);
+    RandomWorkload workload(floors, 0.05 * numElevators, seed);
+
+    auto start = chrono::steady_clock::now();
+    for (long long t = 0; t < ticks; ++t) {
+        while (workload.nextTime() <= sys.getCurrentTime()) {
+            Request r = workload.next();
+            sys.addRequest(r.fromFloor, r.toFloor);
+        }
+        sys.step();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return seconds > 0 ? ticks / seconds : 0.0;
+}
+
+// Tick throughput as floors and elevators grow by orders of magnitude.
+void benchScaling(uint64_t seed) {
+    const int floorCounts[] = {10, 100, 1000, 10000};
+    const int fleetSizes[] = {1, 10, 100, 1000};
+
+    cout << "Scaling benchmark (ticks/s, logging off, 0.05 requests/car/tick)\n";
+    cout << setw(10) << "floors";
+    for (int cars : fleetSizes) {
+        cout << setw(14) << (to_string(cars) + " cars");
+    }
+    cout << "\n";
+
+    for (int floors : floorCounts) {
+        cout << setw(10) << floors;
+        for (int cars : fleetSizes) {
+            // Keep every cell at roughly the same amount of elevator work
+            long long ticks = max(2000LL, 2000000LL / cars);
+            cout << setw(14) << fixed << setprecision(0)
+                 << measureTicksPerSecond(floors, cars, ticks, seed) << flush;
+        }
+        cout << "\n";
+    }
+    cout.unsetf(ios::fixed);
+}
+
+// The original array-of-structs layout: one object per car, each with its
+// own deque of targets. Kept only as the baseline for benchLayout().
+struct AosElevator {
+    int currentFloor = 0;
+    Direction direction = Direction::Idle;
+    bool doorOpen = false;
+    deque<int> targets;
+    int totalStopsServed = 0;
 
-    /*
-       step() simulates one time unit:
-       - If door is open → close it and finish the stop
-       - If no targets → stay idle
-       - Otherwise → move one floor toward next target
-    */
     void step() {
-        // If door is open, close it and complete this stop
         if (doorOpen) {
             doorOpen = false;
             ++totalStopsServed;
-
             if (!targets.empty() && targets.front() == currentFloor) {
                 targets.pop_front();
             }
-
             if (targets.empty()) {
                 direction = Direction::Idle;
             }
             return;
         }
-
-        // No targets -> stay idle
         if (targets.empty()) {
             direction = Direction::Idle;
             return;
         }
-
-        // Move toward the first target in the queue
         int target = targets.front();
-
         if (currentFloor < target) {
             ++currentFloor;
             direction = Direction::Up;
-        }
-        else if (currentFloor > target) {
+        } else if (currentFloor > target) {
             --currentFloor;
             direction = Direction::Down;
-        }
-        else {
-            // Arrived at target -> open door
+        } else {
             doorOpen = true;
         }
     }
+};
 
-    void printStatus() const {
-        cout << "Elevator " << id
-             << " | Floor: " << currentFloor
-             << " | Dir: " << directionToString(direction)
-             << " | Door: " << (doorOpen ? "Open" : "Closed")
-             << " | Queue size: " << targets.size()
-             << '\n';
+void aosAssign(vector<AosElevator>& cars, vector<Request>& pending) {
+    for (const auto& req : pending) {
+        size_t best = 0;
+        int bestScore = numeric_limits<int>::max();
+        for (size_t i = 0; i < cars.size(); ++i) {
+            const AosElevator& e = cars[i];
+            int score = abs(req.fromFloor - e.currentFloor);
+            if ((e.direction == Direction::Up && req.fromFloor < e.currentFloor) ||
+                (e.direction == Direction::Down && req.fromFloor > e.currentFloor)) {
+                score += 5;
+            }
+            score += static_cast<int>(e.targets.size());
+            if (score < bestScore) {
+                bestScore = score;
+                best = i;
+            }
+        }
+        for (int floor : {req.fromFloor, req.toFloor}) {
+            deque<int>& q = cars[best].targets;
+            if (q.empty() || q.back() != floor) {
+                q.push_back(floor);
+            }
+        }
     }
+    pending.clear();
+}
 
-    void logStatus(ofstream& log, int timeStep) const {
-        log << "t=" << timeStep
-            << " Elevator " << id
-            << " Floor=" << currentFloor
-            << " Dir=" << directionToString(direction)
-            << " Door=" << (doorOpen ? "Open" : "Closed")
-            << " QueueSize=" << targets.size()
-            << "\n";
+// aosAssign() on the structure-of-arrays fleet: same score, same ties.
+void soaAssign(ElevatorFleet& fleet, vector<Request>& pending) {
+    const DispatchParams params;
+    for (const auto& req : pending) {
+        size_t best = 0;
+        int bestScore = numeric_limits<int>::max();
+        for (size_t i = 0; i < fleet.size(); ++i) {
+            int score = scoreCar(fleet.currentFloor[i], fleet.direction[i], fleet.queueSize[i],
+                                 req.fromFloor, params);
+            if (score < bestScore) {
+                bestScore = score;
+                best = i;
+            }
+        }
+        fleet.addTarget(best, req.fromFloor);
+        fleet.addTarget(best, req.toFloor);
     }
-};
+    pending.clear();
+}
 
-// ================== ElevatorSystem ==================
+// AoS versus SoA ticks/s on the same workload, doing the same work on
+// both sides: assignment and the car step loop, with no trip tracking,
+// reassignment or logging (ElevatorSystem's bookkeeping is not a layout
+// cost). Total stops served must match, which doubles as a check that
+// both layouts simulate identically. The fleet also keeps each car's
+// stops sorted for the ETA policies; small fleets are overloaded at this
+// rate, and with queues thousands of floors long that index, not the
+// layout, decides the 8-car row.
+void benchLayout(uint64_t seed) {
+    const int fleetSizes[] = {8, 64, 512, 4096};
+    const int floors = 100;
 
-class ElevatorSystem {
-private:
-    int numFloors;
-    vector<Elevator> elevators;
-    vector<Request> pendingRequests;
-    int currentTime;
-    ofstream logFile;
-    int totalRequestsProcessed;
+    cout << "Layout benchmark (" << floors << " floors, ticks/s, assignment and car steps only)\n";
+    cout << setw(8) << "cars" << setw(14) << "AoS" << setw(14) << "SoA"
+         << setw(10) << "speedup" << "\n";
+
+    for (int n : fleetSizes) {
+        long long ticks = max(1000LL, 1000000LL / n);
+        double rate = 0.05 * n;
+
+        vector<AosElevator> cars(n);
+        vector<Request> pending;
+        RandomWorkload aosWork(floors, rate, seed);
+        auto start = chrono::steady_clock::now();
+        for (long long t = 0; t < ticks; ++t) {
+            while (aosWork.nextTime() <= t) {
+                pending.push_back(aosWork.next());
+            }
+            aosAssign(cars, pending);
+            for (auto& e : cars) {
+                e.step();
+            }
+        }
+        double aosSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        long long aosStops = 0;
+        for (const auto& e : cars) {
+            aosStops += e.totalStopsServed;
+        }
+
+        ElevatorFleet fleet;
+        for (int i = 0; i < n; ++i) {
+            fleet.add(0);
+        }
+        RandomWorkload soaWork(floors, rate, seed);
+        start = chrono::steady_clock::now();
+        for (long long t = 0; t < ticks; ++t) {
+            while (soaWork.nextTime() <= t) {
+                pending.push_back(soaWork.next());
+            }
+            soaAssign(fleet, pending);
+            for (size_t i = 0; i < fleet.size(); ++i) {
+                fleet.step(i);
+            }
+        }
+        double soaSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        long long soaStops = 0;
+        for (size_t i = 0; i < fleet.size(); ++i) {
+            soaStops += fleet.totalStopsServed[i];
+        }
 
-    // Direction-aware assignment of requests to elevators
-    void assignRequests() {
-        vector<Request> stillPending;
+        cout << setw(8) << n << fixed << setprecision(0)
+             << setw(14) << ticks / aosSeconds
+             << setw(14) << ticks / soaSeconds
+             << setw(9) << setprecision(2) << aosSeconds / soaSeconds << "x";
+        if (aosStops != soaStops) {
+            cout << "  MISMATCH (" << aosStops << " vs " << soaStops << " stops)";
+        }
+        cout << "\n" << flush;
+    }
+    cout.unsetf(ios::fixed);
+}
 
-        for (const auto& req : pendingRequests) {
-            int bestIndex = -1;
-            int bestScore = numeric_limits<int>::max();
+// Scalar versus dispatched scoring kernel on random fleets; every argmin is
+// cross-checked between the two. Non-default weights keep the queue-weight
+// multiply on the measured path.
+void benchKernel(uint64_t seed) {
+    const int fleetSizes[] = {8, 64, 512, 4096};
+    const int floors = 1000;
+    ScoreKernel fast = defaultScoreKernel();
+    DispatchParams params;
+    params.directionPenalty = 7;
+    params.queueWeight = 3;
 
-            for (size_t i = 0; i < elevators.size(); ++i) {
-                const Elevator& e = elevators[i];
+    cout << "Scoring kernel benchmark (ns per request, " << floors << " floors)\n";
+    cout << "Dispatched kernel: " << (fast == scoreCarsScalar ? "scalar" : "avx2") << "\n";
+    cout << setw(8) << "cars" << setw(12) << "scalar" << setw(12) << "dispatched"
+         << setw(10) << "speedup" << "\n";
 
-                int dist = e.distanceToFloor(req.fromFloor);
-                int score = dist;
+    mt19937_64 rng(seed);
+    for (int n : fleetSizes) {
+        vector<int> carFloors(n), queues(n);
+        vector<int8_t> dirs(n);
+        uniform_int_distribution<int> pickFloor(0, floors - 1);
+        for (int i = 0; i < n; ++i) {
+            carFloors[i] = pickFloor(rng);
+            dirs[i] = static_cast<int8_t>(rng() % 3);
+            queues[i] = static_cast<int>(rng() % 6);
+        }
+        vector<int> calls(4096);
+        for (int& c : calls) {
+            c = pickFloor(rng);
+        }
 
-                Direction dir = e.getDirection();
-                int elevFloor = e.getCurrentFloor();
+        const long long total = max(4096LL, 20000000LL / n);
+        // Each side is called the way HeuristicPolicy calls it: the scalar
+        // loop directly, the dispatched kernel through scoreCars()
+        double ns[2];
+        long long checksum[2] = {0, 0};
+        auto measure = [&](int k, auto score) {
+            auto start = chrono::steady_clock::now();
+            for (long long r = 0; r < total; ++r) {
+                checksum[k] += score(calls[r & 4095]);
+            }
+            ns[k] = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / total;
+        };
+        measure(0, [&](int call) {
+            return scoreCarsScalar(carFloors.data(), dirs.data(), queues.data(), n, call, params);
+        });
+        measure(1, [&](int call) {
+            return scoreCars(fast, carFloors.data(), dirs.data(), queues.data(), n, call, params);
+        });
 
-                bool goingSameWay = false;
+        cout << setw(8) << n << fixed << setprecision(1)
+             << setw(12) << ns[0] << setw(12) << ns[1]
+             << setw(9) << setprecision(2) << ns[0] / ns[1] << "x";
+        if (checksum[0] != checksum[1]) {
+            cout << "  MISMATCH";
+        }
+        cout << "\n" << flush;
+    }
+    cout.unsetf(ios::fixed);
+}
 
-                if (dir == Direction::Idle) {
-                    goingSameWay = true; // idle can go anywhere
-                }
-                else if (dir == Direction::Up && req.fromFloor >= elevFloor) {
-                    goingSameWay = true;
-                }
-                else if (dir == Direction::Down && req.fromFloor <= elevFloor) {
-                    goingSameWay = true;
-                }
+// Raw generation speed of each traffic pattern, no simulation attached.
+void benchGenerator(uint64_t seed) {
+    const int floors = 100;
+    const long long count = 20000000;
+    const char* names[] = {"uppeak", "downpeak", "lunch", "interfloor", "day"};
 
-                // Penalty if going opposite direction
-                if (!goingSameWay && dir != Direction::Idle) {
-                    score += 5;
-                }
+    cout << "Traffic generator benchmark (" << floors << " floors, "
+         << count << " requests each)\n";
+    for (const char* name : names) {
+        string kind = name;
+        TrafficGenerator gen = kind == "day" ? makeOfficeDay(floors, 50.0, 86400, seed)
+            : TrafficGenerator(kind == "uppeak"     ? TrafficPattern::upPeak(floors)
+                               : kind == "downpeak" ? TrafficPattern::downPeak(floors)
+                               : kind == "lunch"    ? TrafficPattern::lunch(floors)
+                                                    : TrafficPattern::interfloor(floors),
+                               50.0, seed);
+        Request r(0, 0, 0);
+        long long checksum = 0;
+        auto start = chrono::steady_clock::now();
+        for (long long k = 0; k < count && gen.next(r); ++k) {
+            checksum += r.fromFloor ^ r.toFloor;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << setw(12) << name << fixed << setprecision(1)
+             << setw(10) << count / seconds / 1e6 << " M requests/s"
+             << "  (checksum " << checksum % 1000 << ")\n";
+    }
+    cout.unsetf(ios::fixed);
+}
+
+// FIFO versus SCAN stop order on identical recorded workloads: trip
+// times, floors traveled per request and the cost of a tick engine step.
+void benchStopOrder(uint64_t seed) {
+    struct Config {
+        int floors;
+        int cars;
+        double rate;
+    };
+    const Config configs[] = {{20, 4, 0.1}, {50, 8, 0.2}, {100, 16, 0.4}, {500, 64, 1.5}};
+    const int ticks = 200000;
 
-                // Prefer shorter queues a bit
-                score += e.getQueueSize();
+    cout << "Stop order benchmark (" << ticks << " ticks, random workload)\n";
+    cout << setw(6) << "floors" << setw(6) << "cars" << setw(7) << "order"
+         << setw(11) << "mean wait" << setw(11) << "mean ride" << setw(11) << "mean trip"
+         << setw(13) << "floors/req" << setw(12) << "ns/step" << "\n";
 
-                if (score < bestScore) {
-                    bestScore = score;
-                    bestIndex = static_cast<int>(i);
+    for (const Config& c : configs) {
+        RandomWorkload source(c.floors, c.rate, seed);
+        vector<Request> requests = recordWorkload(source, ticks);
+
+        for (StopOrder order : {StopOrder::Fifo, StopOrder::Scan}) {
+            ElevatorSystem sys(c.floors, c.cars, "");
+            sys.setVerbose(false);
+            sys.setStopOrder(order);
+            RecordedWorkload workload(requests);
+
+            double seconds = 0.0;
+            while (sys.getCurrentTime() < ticks) {
+                while (workload.nextTime() <= sys.getCurrentTime()) {
+                    Request r = workload.next();
+                    sys.addRequest(r.fromFloor, r.toFloor, r.passengers);
                 }
+                auto start = chrono::steady_clock::now();
+                sys.step();
+                seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
             }
 
-            if (bestIndex != -1) {
-                Elevator& chosen = elevators[bestIndex];
-                // First go to pickup, then to destination
-                chosen.addTarget(req.fromFloor);
-                chosen.addTarget(req.toFloor);
-                ++totalRequestsProcessed;
-            } else {
-                stillPending.push_back(req);
-            }
+            const LatencyHistogram& waits = sys.getTrips().getWaitTimes();
+            const LatencyHistogram& rides = sys.getTrips().getRideTimes();
+            cout << setw(6) << c.floors << setw(6) << c.cars
+                 << setw(7) << (order == StopOrder::Scan ? "scan" : "fifo")
+                 << fixed << setprecision(1)
+                 << setw(11) << waits.mean() << setw(11) << rides.mean()
+                 << setw(11) << waits.mean() + rides.mean()
+                 << setw(13) << setprecision(2)
+                 << static_cast<double>(sys.getFloorsTraveled()) / max<size_t>(1, requests.size())
+                 << setw(12) << setprecision(1) << seconds * 1e9 / ticks << "\n" << flush;
         }
-
-        pendingRequests = stillPending;
     }
+    cout.unsetf(ios::fixed);
+}
 
-  
-    // Print the vertical building view (ASCII-safe version)
+// Every dispatch policy under both stop orders, replaying one recorded
+// workload, so the rows differ only in the policy.
+void benchPolicies(uint64_t seed) {
+    const char* names[] = {"nearest", "heuristic", "collective", "eta", "destination"};
+    const int floors = 100;
+    const int cars = 16;
+    const int ticks = 200000;
+    TrafficGenerator gen(TrafficPattern::interfloor(floors), 0.4, seed);
+    GeneratedWorkload source(gen);
+    vector<Request> requests = recordWorkload(source, ticks);
 
-    void printBuildingView() const {
-        cout << "Building view (top = highest floor)\n\n";
+    cout << "Dispatch policy benchmark (" << floors << " floors, " << cars << " cars, "
+         << requests.size() << " requests over " << ticks << " ticks)\n";
+    cout << setw(12) << "policy" << setw(7) << "order" << setw(11) << "mean wait"
+         << setw(10) << "p99 wait" << setw(11) << "mean ride" << setw(12) << "Mticks/s" << "\n";
 
-        for (int floor = numFloors - 1; floor >= 0; --floor) {
-            cout << "Floor " << floor << " | ";
+    for (const char* name : names) {
+        DispatchPolicy policy = DispatchPolicy::Heuristic;
+        parseDispatchPolicy(name, policy);
+        for (StopOrder order : {StopOrder::Fifo, StopOrder::Scan}) {
+            ElevatorSystem sys(floors, cars, "");
+            sys.setVerbose(false);
+            sys.setStopOrder(order);
+            sys.setDispatchPolicy(policy);
+            RecordedWorkload workload(requests);
 
-            for (const auto& e : elevators) {
-                if (e.getCurrentFloor() == floor) {
-                    char dirChar = 'I';
-                    switch (e.getDirection()) {
-                        case Direction::Up:   dirChar = 'U'; break;
-                        case Direction::Down: dirChar = 'D'; break;
-                        case Direction::Idle: dirChar = 'I'; break;
-                    }
+            auto start = chrono::steady_clock::now();
+            while (sys.getCurrentTime() < ticks) {
+                while (workload.nextTime() <= sys.getCurrentTime()) {
+                    Request r = workload.next();
+                    sys.addRequest(r.fromFloor, r.toFloor, r.passengers);
+                }
+                sys.step();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            const LatencyHistogram& waits = sys.getTrips().getWaitTimes();
+            cout << setw(12) << name << setw(7) << (order == StopOrder::Scan ? "scan" : "fifo")
+                 << fixed << setprecision(1) << setw(11) << waits.mean()
+                 << setw(10) << waits.percentile(0.99)
+                 << setw(11) << sys.getTrips().getRideTimes().mean()
+                 << setw(12) << setprecision(2) << ticks / seconds / 1e6 << "\n" << flush;
+        }
+    }
+    cout.unsetf(ios::fixed);
+}
 
-                    string doorText = e.isDoorOpen() ? "Open" : "Closed";
+// Batch assignment solve latency against batch size, on heuristic costs
+// of random fleets. Both solvers must agree on the optimum; "gap" is how
+// much worse greedy in request order (each car used once) does.
+void benchAssign(uint64_t seed, int threads) {
+    const int floors = 1000;
+    const int carCounts[] = {16, 256, 1000};
+    const int batchSizes[] = {2, 8, 32, 128, 512, 1024};
+    const auto noDeadline = chrono::steady_clock::time_point::max();
+    AssignmentSolver solver;
+    DispatchParams params;
+    mt19937_64 rng(seed);
 
-                    // Example: [E0 U Open]
-                    cout << "[E" << e.getId() << " " << dirChar << " " << doorText << "]";
-                } else {
-                    cout << "[            ]";
+    cout << "Batch assignment benchmark (us per solve, " << threads << " auction threads)\n";
+    cout << setw(6) << "cars" << setw(9) << "requests" << setw(10) << "greedy"
+         << setw(12) << "hungarian" << setw(12) << "auction" << setw(10) << "gap %" << "\n";
+
+    for (int cars : carCounts) {
+        for (int requests : batchSizes) {
+            const int rows = min(cars, requests);
+            const int cols = max(cars, requests);
+            vector<int> cost(static_cast<size_t>(rows) * cols);
+            uniform_int_distribution<int> pickFloor(0, floors - 1);
+            vector<int> carFloor(cars), queue(cars);
+            vector<int8_t> dir(cars);
+            for (int c = 0; c < cars; ++c) {
+                carFloor[c] = pickFloor(rng);
+                dir[c] = static_cast<int8_t>(rng() % 3);
+                queue[c] = static_cast<int>(rng() % 6);
+            }
+            for (int r = 0; r < requests; ++r) {
+                int from = pickFloor(rng);
+                for (int c = 0; c < cars; ++c) {
+                    int score = scoreCar(carFloor[c], dir[c], queue[c], from, params);
+                    cost[requests > cars ? static_cast<size_t>(c) * requests + r
+                                         : static_cast<size_t>(r) * cars + c] = score;
                 }
             }
-            cout << "\n";
+
+            // Repeat each measurement until it has run for ~50 ms
+            auto timeIt = [&](auto solve) {
+                int reps = 0;
+                auto start = chrono::steady_clock::now();
+                double elapsed = 0.0;
+                do {
+                    solve();
+                    ++reps;
+                    elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+                } while (elapsed < 50000.0);
+                return elapsed / reps;
+            };
+            auto total = [&](const vector<int>& match) {
+                long long sum = 0;
+                for (int row = 0; row < rows; ++row) {
+                    sum += cost[static_cast<size_t>(row) * cols + match[row]];
+                }
+                return sum;
+            };
+
+            vector<int> greedy(rows), hungarian, auction;
+            vector<char> taken(cols);
+            double greedyUs = timeIt([&]() {
+                fill(taken.begin(), taken.end(), 0);
+                for (int row = 0; row < rows; ++row) {
+                    const int* line = &cost[static_cast<size_t>(row) * cols];
+                    int best = -1;
+                    for (int col = 0; col < cols; ++col) {
+                        if (!taken[col] && (best < 0 || line[col] < line[best])) {
+                            best = col;
+                        }
+                    }
+                    taken[best] = 1;
+                    greedy[row] = best;
+                }
+            });
+            double hungarianUs = timeIt([&]() {
+                solver.hungarian(cost.data(), rows, cols, hungarian, noDeadline);
+            });
+            double auctionUs = timeIt([&]() {
+                solver.auction(cost.data(), rows, cols, auction, noDeadline, threads);
+            });
+
+            long long optimum = total(hungarian);
+            cout << setw(6) << cars << setw(9) << requests << fixed << setprecision(1)
+                 << setw(10) << greedyUs << setw(12) << hungarianUs << setw(12) << auctionUs
+                 << setw(10) << (optimum ? 100.0 * (total(greedy) - optimum) / optimum : 0.0);
+            if (total(auction) != optimum) {
+                cout << "  MISMATCH";
+            }
+            cout << "\n" << flush;
         }
+    }
+    cout.unsetf(ios::fixed);
+}
 
-        cout << "\nLegend: U=Up, D=Down, I=Idle, Door: Open/Closed\n\n";
+// ================== Core benchmark suite ==================
+
+/*
+   `--bench core` times the simulator's hot paths one at a time over a
+   matrix of building sizes, fleet sizes and assignment batch depths:
+
+     step        Elevator::step() on loaded cars (ns per car step)
+     assign      ElevatorSystem::assignPending() (ns per request)
+     log-text    SimLog::write() of status records (ns per record)
+     log-binary
+     tick        ElevatorSystem::step() under random load (ns per tick)
+
+   with heap allocations per op from the global operator new counter in
+   allocation-counting builds. Rows can be written as CSV and checked
+   against an earlier run.
+*/
+struct CoreResult {
+    string name;
+    int floors;
+    int cars;
+    int depth;          // requests per assignment; 0 where not applicable
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+// Wall time and allocations of one timed section, summed over calls.
+struct CoreTimer {
+    double seconds = 0;
+    uint64_t allocations = 0;
+
+    template <typename Fn>
+    void time(Fn fn) {
+        uint64_t before = allocationCount();
+        auto start = chrono::steady_clock::now();
+        fn();
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        allocations += allocationCount() - before;
     }
 
+    CoreResult result(const string& name, int floors, int cars, int depth, double ops) const {
+        return CoreResult{name, floors, cars, depth, seconds * 1e9 / ops, allocations / ops};
+    }
+};
 
+CoreResult coreStep(int floors, int cars, uint64_t seed) {
+    ElevatorFleet fleet;
+    vector<Elevator> handles;
+    for (int i = 0; i < cars; ++i) {
+        fleet.add(0);
+    }
+    for (int i = 0; i < cars; ++i) {
+        handles.emplace_back(fleet, i);
+    }
+    mt19937_64 rng(seed);
+    vector<int> stops(4096);
+    for (int& f : stops) {
+        f = static_cast<int>(rng() % static_cast<uint64_t>(floors));
+    }
 
-public:
-    ElevatorSystem(int floors, int numElevators)
-        : numFloors(floors),
-          currentTime(0),
-          totalRequestsProcessed(0)
-    {
-        for (int i = 0; i < numElevators; ++i) {
-            elevators.emplace_back(i, 0); // all start at floor 0
+    const long long rounds = max(1000LL, 10000000LL / cars);
+    size_t next = 0;
+    CoreTimer timer;
+    timer.time([&]() {
+        for (long long r = 0; r < rounds; ++r) {
+            for (Elevator& e : handles) {
+                if (e.getQueueSize() < 2) {
+                    e.addTarget(stops[next++ & (stops.size() - 1)]);
+                }
+                e.step();
+            }
         }
+    });
+    return timer.result("step", floors, cars, 0, static_cast<double>(rounds) * cars);
+}
 
-        logFile.open("elevator_log.txt");
-        if (logFile.is_open()) {
-            logFile << "Elevator Simulation Log\n";
-        }
-    }
+CoreResult coreAssign(int floors, int cars, int depth, uint64_t seed) {
+    RandomWorkload calls(floors, 1.0, seed);
+    const long long total = max(50000LL, 100LL * depth);
+    // A fresh system now and then keeps the queues at a working size
+    const long long perSystem = max(2000LL, 4LL * depth);
 
-    ~ElevatorSystem() {
-        if (logFile.is_open()) {
-            logFile << "Simulation ended. Total time steps: "
-                    << currentTime << "\n";
-            logFile.close();
+    unique_ptr<ElevatorSystem> sys;
+    long long assigned = 0;
+    CoreTimer timer;
+    while (assigned < total) {
+        if (assigned % perSystem < depth) {
+            sys.reset(new ElevatorSystem(floors, cars, ""));
+            sys->setVerbose(false);
+        }
+        for (int k = 0; k < depth; ++k) {
+            Request r = calls.next();
+            sys->addRequest(r.fromFloor, r.toFloor);
         }
+        timer.time([&]() { sys->assignPending(); });
+        sys->step();
+        assigned += depth;
     }
+    return timer.result("assign", floors, cars, depth, static_cast<double>(assigned));
+}
 
-    int getNumFloors() const { return numFloors; }
-    int getCurrentTime() const { return currentTime; }
+CoreResult coreLog(LogFormat format, int floors, int cars) {
+    LogOptions logOpts;
+    logOpts.format = format;
+    SimLog log;
+    log.open("/dev/null", logOpts, floors, cars);
 
-    void addRequest(int fromFloor, int toFloor) {
-        if (fromFloor < 0 || fromFloor >= numFloors ||
-            toFloor   < 0 || toFloor   >= numFloors) {
-            cout << "Invalid request. Floors must be between 0 and "
-                 << numFloors - 1 << ".\n";
-            return;
+    const int ticks = max(200, 1000000 / cars);
+    CoreTimer timer;
+    timer.time([&]() {
+        for (int t = 1; t <= ticks; ++t) {
+            for (int i = 0; i < cars; ++i) {
+                log.write(LogRecord::status(t, i, (t + i) % floors, Direction::Up,
+                                            (t & 7) == 0, i & 15));
+            }
         }
-        if (fromFloor == toFloor) {
-            cout << "You are already on that floor.\n";
-            return;
+        log.close(ticks);
+    });
+    const char* name = format == LogFormat::Binary ? "log-binary" : "log-text";
+    return timer.result(name, floors, cars, 0, static_cast<double>(ticks) * cars);
+}
+
+CoreResult coreTick(int floors, int cars, uint64_t seed) {
+    ElevatorSystem sys(floors, cars, "");
+    sys.setVerbose(false);
+    RandomWorkload workload(floors, 0.05 * cars, seed);
+    const int ticks = max(2000, 1000000 / cars);
+
+    CoreTimer timer;
+    timer.time([&]() {
+        for (int t = 0; t < ticks; ++t) {
+            while (workload.nextTime() <= sys.getCurrentTime()) {
+                Request r = workload.next();
+                sys.addRequest(r.fromFloor, r.toFloor);
+            }
+            sys.step();
         }
+    });
+    return timer.result("tick", floors, cars, 0, ticks);
+}
 
-        pendingRequests.emplace_back(fromFloor, toFloor, currentTime);
-        cout << "Request added from floor " << fromFloor
-             << " to floor " << toFloor << ".\n";
+// Fastest of `runs` measurements: the least disturbed by the rest of the
+// machine, so the one worth comparing across runs.
+template <typename Measure>
+CoreResult bestOf(int runs, Measure measure) {
+    CoreResult best = measure();
+    for (int k = 1; k < runs; ++k) {
+        CoreResult r = measure();
+        if (r.nsPerOp < best.nsPerOp) {
+            best = r;
+        }
     }
+    return best;
+}
 
-    void step() {
-        ++currentTime;
+string coreKey(const CoreResult& r) {
+    return r.name + "," + to_string(r.floors) + "," + to_string(r.cars) + "," +
+           to_string(r.depth);
+}
 
-        assignRequests();
+const char* CORE_CSV_HEADER = "benchmark,floors,cars,depth,ns_per_op,ops_per_sec,allocs_per_op";
 
-        for (auto& elevator : elevators) {
-            elevator.step();
+bool writeCoreCsv(const string& path, const vector<CoreResult>& results) {
+    ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    out << CORE_CSV_HEADER << "\n";
+    for (const CoreResult& r : results) {
+        out << coreKey(r) << "," << r.nsPerOp << "," << 1e9 / r.nsPerOp << ",";
+        if (ALLOCATIONS_COUNTED) {
+            out << r.allocsPerOp;
         }
+        out << "\n";
+    }
+    return true;
+}
 
-        if (logFile.is_open()) {
-            for (const auto& elevator : elevators) {
-                elevator.logStatus(logFile, currentTime);
-            }
+// ns/op per row key from a CSV written by writeCoreCsv().
+bool readCoreCsv(const string& path, map<string, double>& nsPerOp) {
+    ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    string line;
+    getline(in, line);  // header
+    while (getline(in, line)) {
+        // The key is the first four fields, ns/op the fifth
+        size_t end = 0;
+        for (int field = 0; field < 4 && end != string::npos; ++field) {
+            end = line.find(',', end == 0 ? 0 : end + 1);
+        }
+        if (end != string::npos) {
+            nsPerOp[line.substr(0, end)] = atof(line.c_str() + end + 1);
         }
     }
+    return true;
+}
 
-    void printStatus() const {
-        cout << "\n=== Time step: " << currentTime << " ===\n";
+int benchCore(const BatchOptions& opts) {
+    const int floorCounts[] = {10, 100, 1000};
+    const int fleetSizes[] = {4, 32, 256};
+    const int depths[] = {1, 32, 512};
+    const int runs = 3;
 
-        // Visual building representation
-        printBuildingView();
+    map<string, double> baseline;
+    if (!opts.baseline.empty() && !readCoreCsv(opts.baseline, baseline)) {
+        cerr << "Cannot read baseline " << opts.baseline << "\n";
+        return 1;
+    }
 
-        // Detailed per-elevator info
-        cout << "Elevator details:\n";
-        for (const auto& elevator : elevators) {
-            elevator.printStatus();
+    cout << "Core benchmark (ns per op; "
+         << (ALLOCATIONS_COUNTED ? "allocs per op from operator new"
+                                 : "allocs not counted, build with make CHECK_ALLOC=1")
+         << ")\n";
+    cout << setw(11) << "benchmark" << setw(7) << "floors" << setw(6) << "cars"
+         << setw(7) << "depth" << setw(12) << "ns/op" << setw(14) << "ops/s"
+         << setw(10) << "allocs";
+    if (!baseline.empty()) {
+        cout << setw(10) << "vs base";
+    }
+    cout << "\n";
+
+    vector<CoreResult> results;
+    int regressions = 0;
+    streamsize oldPrecision = cout.precision();
+    auto report = [&](const CoreResult& r) {
+        results.push_back(r);
+        cout << setw(11) << r.name << setw(7) << r.floors << setw(6) << r.cars
+             << setw(7) << r.depth << fixed << setprecision(1) << setw(12) << r.nsPerOp
+             << setprecision(0) << setw(14) << 1e9 / r.nsPerOp
+             << setprecision(3) << setw(10);
+        if (ALLOCATIONS_COUNTED) {
+            cout << r.allocsPerOp;
+        } else {
+            cout << "-";
+        }
+        auto it = baseline.find(coreKey(r));
+        if (it != baseline.end() && it->second > 0) {
+            double change = (r.nsPerOp / it->second - 1) * 100;
+            cout << setprecision(1) << setw(9) << showpos << change << noshowpos << "%";
+            if (change > opts.regressThreshold) {
+                cout << "  REGRESSION";
+                ++regressions;
+            }
         }
+        cout << "\n" << flush;
+        cout.unsetf(ios::fixed);
+        cout.precision(oldPrecision);
+    };
 
-        cout << "Pending requests: " << pendingRequests.size() << "\n";
+    for (int floors : floorCounts) {
+        for (int cars : fleetSizes) {
+            report(bestOf(runs, [&]() { return coreStep(floors, cars, opts.seed); }));
+        }
     }
-
-    void printSummary() const {
-        cout << "\n===== Simulation Summary =====\n";
-        cout << "Total time steps: " << currentTime << "\n";
-        cout << "Total requests processed (assigned): " << totalRequestsProcessed << "\n";
-        for (const auto& e : elevators) {
-            cout << "Elevator " << e.getId()
-                 << " served stops: " << e.getTotalStopsServed() << "\n";
+    for (int floors : floorCounts) {
+        for (int cars : fleetSizes) {
+            for (int depth : depths) {
+                report(bestOf(runs, [&]() {
+                    return coreAssign(floors, cars, depth, opts.seed);
+                }));
+            }
+        }
+    }
+    for (LogFormat format : {LogFormat::Text, LogFormat::Binary}) {
+        for (int cars : fleetSizes) {
+            report(bestOf(runs, [&]() { return coreLog(format, 100, cars); }));
+        }
+    }
+    for (int floors : floorCounts) {
+        for (int cars : fleetSizes) {
+            report(bestOf(runs, [&]() { return coreTick(floors, cars, opts.seed); }));
         }
-        cout << "Log saved to elevator_log.txt (if file I/O is allowed).\n";
     }
-};
 
-// ================== Helper ==================
+    if (!opts.benchOut.empty()) {
+        if (!writeCoreCsv(opts.benchOut, results)) {
+            cerr << "Cannot write " << opts.benchOut << "\n";
+            return 1;
+        }
+        cout << "Results written to " << opts.benchOut << "\n";
+    }
+    if (!baseline.empty()) {
+        cout << regressions << " regression(s) beyond " << opts.regressThreshold
+             << "% against " << opts.baseline << "\n";
+    }
+    return regressions > 0 ? 1 : 0;
+}
 
-void clearInput() {
-    cin.clear();
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+int runBenchmark(const BatchOptions& opts) {
+    if (opts.bench == "scaling") {
+        benchScaling(opts.seed);
+    } else if (opts.bench == "layout") {
+        benchLayout(opts.seed);
+    } else if (opts.bench == "kernel") {
+        benchKernel(opts.seed);
+    } else if (opts.bench == "generator") {
+        benchGenerator(opts.seed);
+    } else if (opts.bench == "stops") {
+        benchStopOrder(opts.seed);
+    } else if (opts.bench == "policies") {
+        benchPolicies(opts.seed);
+    } else if (opts.bench == "assign") {
+        benchAssign(opts.seed, opts.threads);
+    } else if (opts.bench == "core") {
+        return benchCore(opts);
+    }
+    return 0;
 }
 
 // ================== main ==================
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        BatchOptions opts;
+        if (string(argv[1]) == "--help" || string(argv[1]) == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (string(argv[1]) == "--convert-log" && argc == 4) {
+            return convertLog(argv[2], argv[3]) ? 0 : 1;
+        }
+        if (!parseBatchOptions(argc, argv, opts)) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (!opts.bench.empty()) {
+            return runBenchmark(opts);
+        }
+#ifdef ELEVATOR_CHECK_ALLOC
+        if (opts.checkAlloc) {
+            return runAllocationCheck(opts);
+        }
+#endif
+        if (!opts.sweep.empty()) {
+            return runSweep(opts);
+        }
+        if (opts.whatIfAt >= 0) {
+            return runWhatIf(opts);
+        }
+        return opts.replicas > 1 ? runEnsemble(opts) : runBatch(opts);
+    }
+
     cout << "===== Elevator Simulation =====\n";
 
     int floors;
     int numElevators;
 
-    cout << "Enter number of floors (5 - 20): ";
+    cout << "Enter number of floors (2 - " << MAX_FLOORS << "): ";
     cin >> floors;
-    if (!cin || floors < 5 || floors > 20) {
+    if (!cin || floors < 2 || floors > MAX_FLOORS) {
         cout << "Invalid input. Defaulting to 10 floors.\n";
         clearInput();
         floors = 10;
     }
 
-    cout << "Enter number of elevators (1 - 5): ";
+    cout << "Enter number of elevators (1 - " << MAX_ELEVATORS << "): ";
     cin >> numElevators;
-    if (!cin || numElevators < 1 || numElevators > 5) {
+    if (!cin || numElevators < 1 || numElevators > MAX_ELEVATORS) {
         cout << "Invalid input. Defaulting to 2 elevators.\n";
         clearInput();
         numElevators = 2;
@@ -374,7 +6750,9 @@ int main() {
         cout << "  a - auto-run 5 steps\n";
         cout << "  q - quit simulation\n";
         cout << "Enter command: ";
-        cin >> command;
+        if (!(cin >> command)) {
+            break; // end of input
+        }
 
         switch (command) {
             case 'r':